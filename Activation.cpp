@@ -0,0 +1,37 @@
+#include "Activation.h"
+
+ActivationKernels activationKernels(const ActivationType type) {
+    switch (type) {
+        case ActivationType::Relu:
+            return makeActivationKernels<ReluActivation>();
+        case ActivationType::LeakyRelu:
+            return makeActivationKernels<LeakyReluActivation>();
+        case ActivationType::Gelu:
+            return makeActivationKernels<GeluActivation>();
+        case ActivationType::Tanh:
+            return makeActivationKernels<TanhActivation>();
+        case ActivationType::Identity:
+            return makeActivationKernels<IdentityActivation>();
+        case ActivationType::Sigmoid:
+        default:
+            return makeActivationKernels<SigmoidActivation>();
+    }
+}
+
+std::string activationName(const ActivationType type) {
+    switch (type) {
+        case ActivationType::Relu:
+            return "relu";
+        case ActivationType::LeakyRelu:
+            return "leaky_relu";
+        case ActivationType::Gelu:
+            return "gelu";
+        case ActivationType::Tanh:
+            return "tanh";
+        case ActivationType::Identity:
+            return "identity";
+        case ActivationType::Sigmoid:
+        default:
+            return "sigmoid";
+    }
+}
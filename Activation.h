@@ -0,0 +1,173 @@
+#ifndef ACTIVATION_H
+#define ACTIVATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "ActivationMath.h"
+#include "Philox.h"
+
+enum class ActivationType { Sigmoid, Relu, LeakyRelu, Gelu, Tanh, Identity };
+
+// Activation policies: forward maps pre-activations z to outputs y (z and y never alias),
+// derivative gives f'(z) from both the pre-activation and the output so each policy uses the cheaper one.
+struct SigmoidActivation {
+    static constexpr double Flops = 20.0; // per element, sizes parallel chunks
+    static void forward(const double* z, double* y, const std::size_t count) {
+        ActivationMath::sigmoid(z, y, count);
+    }
+    static double derivative(double, const double y) { return y * (1.0 - y); }
+};
+
+struct ReluActivation {
+    static constexpr double Flops = 1.0;
+    static void forward(const double* z, double* y, const std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            y[i] = z[i] > 0.0 ? z[i] : 0.0;
+        }
+    }
+    static double derivative(const double z, double) { return z > 0.0 ? 1.0 : 0.0; }
+};
+
+struct LeakyReluActivation {
+    static constexpr double Flops = 1.0;
+    static constexpr double Slope = 0.01;
+    static void forward(const double* z, double* y, const std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            y[i] = z[i] > 0.0 ? z[i] : Slope * z[i];
+        }
+    }
+    static double derivative(const double z, double) { return z > 0.0 ? 1.0 : Slope; }
+};
+
+// tanh approximation of GELU: 0.5 z (1 + tanh(sqrt(2/pi) (z + 0.044715 z^3)))
+struct GeluActivation {
+    static constexpr double Flops = 30.0;
+    static constexpr double Scale = 0.7978845608028654;
+    static constexpr double Cubic = 0.044715;
+    static void forward(const double* z, double* y, const std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            y[i] = Scale * (z[i] + Cubic * z[i] * z[i] * z[i]);
+        }
+        ActivationMath::tanh(y, y, count);
+        for (std::size_t i = 0; i < count; ++i) {
+            y[i] = 0.5 * z[i] * (1.0 + y[i]);
+        }
+    }
+    static double derivative(const double z, double) {
+        const double t = std::tanh(Scale * (z + Cubic * z * z * z));
+        return 0.5 * (1.0 + t) + 0.5 * z * (1.0 - t * t) * Scale * (1.0 + 3.0 * Cubic * z * z);
+    }
+};
+
+struct TanhActivation {
+    static constexpr double Flops = 20.0;
+    static void forward(const double* z, double* y, const std::size_t count) {
+        ActivationMath::tanh(z, y, count);
+    }
+    static double derivative(double, const double y) { return 1.0 - y * y; }
+};
+
+struct IdentityActivation {
+    static constexpr double Flops = 1.0;
+    static void forward(const double* z, double* y, const std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            y[i] = z[i];
+        }
+    }
+    static double derivative(double, double) { return 1.0; }
+};
+
+// Training-time noise and dropout for one layer. Elements are processed in tiles of 64, one mask word each,
+// so the random draws, the activation and the mask all happen while the tile is in L1.
+struct StochasticContext {
+    const Philox* rng = nullptr;
+    std::uint64_t noiseStream = 0;
+    std::uint64_t dropoutStream = 0;
+    double noiseStddev = 0.0;      // Gaussian noise added to the pre-activation
+    double dropoutRate = 0.0;      // inverted dropout: kept outputs are scaled by 1 / (1 - rate)
+    std::uint64_t* mask = nullptr; // packed keep bits for the whole layer
+    std::size_t firstElement = 0;  // layer index of z[0], a multiple of 64
+};
+
+static constexpr std::size_t MaskTile = 64;
+
+inline bool maskBit(const std::uint64_t* mask, const std::size_t element) {
+    return (mask[element / MaskTile] >> (element % MaskTile)) & 1u;
+}
+
+// Whole-vector kernels specialized for one policy. A layer resolves these once, so the per-element
+// work is inlined and never dispatched on the activation type.
+struct ActivationKernels {
+    void (*forward)(const double* z, double* y, std::size_t count) = nullptr;
+    // delta[i] = error[i] * f'(z[i])
+    void (*backward)(const double* z, const double* y, const double* error, double* delta, std::size_t count) = nullptr;
+    // Training forward with noise on z (updated in place) and a dropout mask written to ctx.mask
+    void (*forwardStochastic)(double* z, double* y, std::size_t count, const StochasticContext& ctx) = nullptr;
+    // backward for a dropout layer: y holds the scaled outputs, firstElement indexes the mask
+    void (*backwardMasked)(const double* z, const double* y, const double* error, double* delta, std::size_t count,
+                           const std::uint64_t* mask, std::size_t firstElement, double dropoutRate) = nullptr;
+    double flopsPerElement = 1.0;
+};
+
+template <typename Policy>
+void activationBackward(const double* z, const double* y, const double* error, double* delta, const std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        delta[i] = error[i] * Policy::derivative(z[i], y[i]);
+    }
+}
+
+template <typename Policy>
+void activationForwardStochastic(double* z, double* y, const std::size_t count, const StochasticContext& ctx) {
+    const double scale = 1.0 / (1.0 - ctx.dropoutRate);
+    const auto dropThreshold = static_cast<std::uint64_t>(ctx.dropoutRate * 4294967296.0);
+    double noise[MaskTile];
+    std::uint32_t random[MaskTile];
+    for (std::size_t tile = 0; tile < count; tile += MaskTile) {
+        const std::size_t n = std::min(MaskTile, count - tile);
+        const std::size_t element = ctx.firstElement + tile;
+        if (ctx.noiseStddev > 0.0) {
+            ctx.rng->normal(ctx.noiseStream, element, noise, n, 0.0, ctx.noiseStddev);
+            for (std::size_t i = 0; i < n; ++i) {
+                z[tile + i] += noise[i];
+            }
+        }
+        Policy::forward(z + tile, y + tile, n);
+        if (ctx.dropoutRate > 0.0) {
+            ctx.rng->bits(ctx.dropoutStream, element, random, n);
+            std::uint64_t word = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                const bool keep = random[i] >= dropThreshold;
+                word |= static_cast<std::uint64_t>(keep) << i;
+                y[tile + i] = keep ? y[tile + i] * scale : 0.0;
+            }
+            ctx.mask[element / MaskTile] = word;
+        }
+    }
+}
+
+template <typename Policy>
+void activationBackwardMasked(const double* z, const double* y, const double* error, double* delta, const std::size_t count,
+                              const std::uint64_t* mask, const std::size_t firstElement, const double dropoutRate) {
+    const double scale = 1.0 / (1.0 - dropoutRate);
+    for (std::size_t i = 0; i < count; ++i) {
+        // Kept outputs were scaled, the derivative needs the unscaled activation y / scale
+        delta[i] = maskBit(mask, firstElement + i)
+                       ? error[i] * scale * Policy::derivative(z[i], y[i] * (1.0 - dropoutRate))
+                       : 0.0;
+    }
+}
+
+template <typename Policy>
+constexpr ActivationKernels makeActivationKernels() {
+    return ActivationKernels{&Policy::forward, &activationBackward<Policy>, &activationForwardStochastic<Policy>,
+                             &activationBackwardMasked<Policy>, Policy::Flops};
+}
+
+ActivationKernels activationKernels(ActivationType type);
+std::string activationName(ActivationType type);
+
+#endif //ACTIVATION_H
@@ -0,0 +1,151 @@
+#include "ActivationMath.h"
+
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+namespace {
+    MathAccuracy accuracyFromEnvironment() {
+        const char* value = std::getenv("NN_MATH_ACCURACY");
+        if (value == nullptr) {
+            return MathAccuracy::Exact;
+        }
+        const std::string name(value);
+        if (name == "fast") {
+            return MathAccuracy::Fast;
+        }
+        if (name == "faster") {
+            return MathAccuracy::Faster;
+        }
+        return MathAccuracy::Exact;
+    }
+
+    std::atomic<MathAccuracy> currentAccuracy{accuracyFromEnvironment()};
+
+    constexpr double Log2e = 1.4426950408889634;
+    constexpr double Ln2Hi = 0.693147180369123816490;  // ln(2) split so n * Ln2Hi is exact
+    constexpr double Ln2Lo = 1.90821492927058770002e-10;
+    constexpr double RoundMagic = 6755399441055744.0;   // 1.5 * 2^52, adding it rounds to the nearest integer
+    constexpr double ExpMax = 709.0;
+    constexpr double ExpMin = -708.0;
+
+    // Horner form of the Taylor series, 1 + r/(K+1) * (1 + r/(K+2) * (...)), unrolled at compile time
+    template <int K, int Degree>
+    inline double expSeries(const double r) {
+        if constexpr (K == Degree) {
+            return 1.0;
+        } else {
+            return 1.0 + r * (1.0 / (K + 1)) * expSeries<K + 1, Degree>(r);
+        }
+    }
+
+    // e^x = 2^n * e^r with |r| <= ln(2)/2, e^r from a Taylor polynomial of the given degree
+    template <int Degree>
+    inline double expPoly(double x) {
+        // max/min through fabs: plain SSE2 cannot vectorize a NaN-correct ternary, this costs ~1e-13 relative
+        x = 0.5 * (x + ExpMin + std::fabs(x - ExpMin));
+        x = 0.5 * (x + ExpMax - std::fabs(x - ExpMax));
+        const double shifted = x * Log2e + RoundMagic;
+        const double n = shifted - RoundMagic;
+        const double r = (x - n * Ln2Hi) - n * Ln2Lo;
+
+        const double p = expSeries<0, Degree>(r);
+
+        // The low mantissa bits of shifted hold n, move n + 1023 into the exponent field to get 2^n.
+        // Integer-only so it vectorizes without a double -> int64 conversion.
+        const std::uint64_t bits = std::bit_cast<std::uint64_t>(shifted);
+        return p * std::bit_cast<double>((bits + 1023) << 52);
+    }
+
+    template <int Degree>
+    void expLoop(const double* in, double* out, const std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = expPoly<Degree>(in[i]);
+        }
+    }
+
+    template <int Degree>
+    void sigmoidLoop(const double* in, double* out, const std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = 1.0 / (1.0 + expPoly<Degree>(-in[i]));
+        }
+    }
+
+    template <int Degree>
+    void tanhLoop(const double* in, double* out, const std::size_t count) {
+        // tanh(x) = 1 - 2 / (e^2x + 1)
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = 1.0 - 2.0 / (expPoly<Degree>(2.0 * in[i]) + 1.0);
+        }
+    }
+
+    constexpr int FastDegree = 7;
+    constexpr int FasterDegree = 4;
+}
+
+void ActivationMath::setAccuracy(const MathAccuracy accuracy) {
+    currentAccuracy.store(accuracy, std::memory_order_relaxed);
+}
+
+MathAccuracy ActivationMath::accuracy() {
+    return currentAccuracy.load(std::memory_order_relaxed);
+}
+
+double ActivationMath::exp(const double x) {
+    switch (accuracy()) {
+        case MathAccuracy::Fast:
+            return expPoly<FastDegree>(x);
+        case MathAccuracy::Faster:
+            return expPoly<FasterDegree>(x);
+        default:
+            return std::exp(x);
+    }
+}
+
+void ActivationMath::exp(const double* in, double* out, const std::size_t count) {
+    switch (accuracy()) {
+        case MathAccuracy::Fast:
+            expLoop<FastDegree>(in, out, count);
+            break;
+        case MathAccuracy::Faster:
+            expLoop<FasterDegree>(in, out, count);
+            break;
+        default:
+            for (std::size_t i = 0; i < count; ++i) {
+                out[i] = std::exp(in[i]);
+            }
+    }
+}
+
+void ActivationMath::sigmoid(const double* in, double* out, const std::size_t count) {
+    switch (accuracy()) {
+        case MathAccuracy::Fast:
+            sigmoidLoop<FastDegree>(in, out, count);
+            break;
+        case MathAccuracy::Faster:
+            sigmoidLoop<FasterDegree>(in, out, count);
+            break;
+        default:
+            for (std::size_t i = 0; i < count; ++i) {
+                out[i] = 1.0 / (1.0 + std::exp(-in[i]));
+            }
+    }
+}
+
+void ActivationMath::tanh(const double* in, double* out, const std::size_t count) {
+    switch (accuracy()) {
+        case MathAccuracy::Fast:
+            tanhLoop<FastDegree>(in, out, count);
+            break;
+        case MathAccuracy::Faster:
+            tanhLoop<FasterDegree>(in, out, count);
+            break;
+        default:
+            for (std::size_t i = 0; i < count; ++i) {
+                out[i] = std::tanh(in[i]);
+            }
+    }
+}
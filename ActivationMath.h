@@ -0,0 +1,33 @@
+#ifndef ACTIVATIONMATH_H
+#define ACTIVATIONMATH_H
+
+#include <cstddef>
+
+// Accuracy tiers for the transcendental activations, error against libm over the range the network uses
+// (|x| <= 700 for exp and sigmoid, |x| <= 350 for tanh). The bound is relative for exp and sigmoid and absolute
+// for tanh, whose 1 - 2 / (e^2x + 1) form cancels near 0. tests/ActivationMathTest checks it.
+//   Exact  - libm exp/tanh
+//   Fast   - range reduction + degree 7 polynomial, below 1e-8
+//   Faster - range reduction + degree 4 polynomial, below 6e-5
+enum class MathAccuracy { Exact, Fast, Faster };
+
+class ActivationMath {
+public:
+    // Global switch read by every kernel, NN_MATH_ACCURACY=exact|fast|faster sets the initial value
+    static void setAccuracy(MathAccuracy accuracy);
+    static MathAccuracy accuracy();
+
+    static double exp(double x);
+
+    // Array versions pick the tier once per call and run a branch-free loop the compiler can vectorize.
+    // in and out may alias.
+    static void exp(const double* in, double* out, std::size_t count);
+    static void sigmoid(const double* in, double* out, std::size_t count);
+    static void tanh(const double* in, double* out, std::size_t count);
+
+    // Derivatives expressed through the activation's output, no transcendental needed
+    static double sigmoidDerivativeFromOutput(const double output) { return output * (1.0 - output); }
+    static double tanhDerivativeFromOutput(const double output) { return 1.0 - output * output; }
+};
+
+#endif //ACTIVATIONMATH_H
@@ -0,0 +1,186 @@
+#ifndef ASYNCTASK_H
+#define ASYNCTASK_H
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "ThreadPool.h"
+
+// Coroutine tasks on the shared ThreadPool. A task starts on an idle pool worker as soon as it is created
+// and its creator carries on; coroutines co_await its result, plain code blocks in get(). Without pool
+// workers a task runs inline while it is created.
+//
+//     Async::Task<EvaluationResult> score = Async::spawn([&] { return snapshot.evaluate(validation); });
+//     ...                                   // runs while the snapshot is scored
+//     const EvaluationResult result = score.get();
+//
+// A task occupies a compute worker until it finishes or suspends, so it is for computation: blocking work such
+// as file I/O belongs on a thread of its own. Inside a task, wait for other tasks with co_await, never get():
+// blocked workers could end up waiting on each other.
+namespace Async {
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+    // Outlives the coroutine frame while the finishing thread still signals it
+    struct Completion {
+        std::mutex mutex;
+        std::condition_variable finished;
+        bool done = false;
+        std::coroutine_handle<> continuation; // a coroutine awaiting the task
+    };
+
+    // Suspends the new coroutine and resumes it on a pool worker
+    struct StartOnPool {
+        [[nodiscard]] bool await_ready() const noexcept { return false; }
+        void await_suspend(const std::coroutine_handle<> handle) const {
+            ThreadPool::instance().post([handle] { handle.resume(); });
+        }
+        void await_resume() const noexcept {}
+    };
+
+    struct FinishTask {
+        [[nodiscard]] bool await_ready() const noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(const std::coroutine_handle<Promise> handle) const noexcept {
+            // The owner may destroy the frame, this awaiter included, as soon as done is set
+            const std::shared_ptr<Completion> completion = handle.promise().completion;
+            std::coroutine_handle<> next = std::noop_coroutine();
+            std::lock_guard lock(completion->mutex);
+            completion->done = true;
+            if (completion->continuation) {
+                next = completion->continuation;
+            }
+            completion->finished.notify_all();
+            return next;
+        }
+        void await_resume() const noexcept {}
+    };
+
+    struct PromiseBase {
+        std::shared_ptr<Completion> completion = std::make_shared<Completion>();
+        std::exception_ptr error;
+
+        [[nodiscard]] StartOnPool initial_suspend() const noexcept { return {}; }
+        [[nodiscard]] FinishTask final_suspend() const noexcept { return {}; }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    template <typename T>
+    struct Promise : PromiseBase {
+        std::optional<T> value;
+
+        Task<T> get_return_object();
+        void return_value(T result) { value.emplace(std::move(result)); }
+    };
+
+    template <>
+    struct Promise<void> : PromiseBase {
+        Task<void> get_return_object();
+        void return_void() const noexcept {}
+    };
+}
+
+template <typename T>
+class Task {
+public:
+    using promise_type = detail::Promise<T>;
+
+    Task() = default;
+    explicit Task(const std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    // Waits for a task still running, its frame refers to the caller's data
+    ~Task() { reset(); }
+
+    [[nodiscard]] bool valid() const { return static_cast<bool>(handle); }
+    [[nodiscard]] bool ready() const {
+        std::lock_guard lock(handle.promise().completion->mutex);
+        return handle.promise().completion->done;
+    }
+
+    // Blocks until the task has finished
+    void wait() const {
+        detail::Completion& completion = *handle.promise().completion;
+        std::unique_lock lock(completion.mutex);
+        completion.finished.wait(lock, [&] { return completion.done; });
+    }
+    // Waits, then returns the task's result or rethrows its exception. Call once.
+    T get() {
+        wait();
+        return take();
+    }
+
+    [[nodiscard]] bool await_ready() const { return ready(); }
+    bool await_suspend(const std::coroutine_handle<> awaiting) {
+        detail::Completion& completion = *handle.promise().completion;
+        std::lock_guard lock(completion.mutex);
+        if (completion.done) {
+            return false; // finished meanwhile, carry on without suspending
+        }
+        completion.continuation = awaiting;
+        return true;
+    }
+    T await_resume() { return take(); }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    T take() {
+        promise_type& promise = handle.promise();
+        if (promise.error) {
+            std::rethrow_exception(promise.error);
+        }
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(*promise.value);
+        }
+    }
+
+    void reset() {
+        if (!handle) {
+            return;
+        }
+        wait();
+        handle.destroy();
+        handle = {};
+    }
+};
+
+template <typename T>
+Task<T> detail::Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise>::from_promise(*this));
+}
+
+inline Task<void> detail::Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise>::from_promise(*this));
+}
+
+// Runs fn() as a task, fn is moved into it
+template <typename Fn>
+Task<std::invoke_result_t<Fn&>> spawn(Fn fn) {
+    if constexpr (std::is_void_v<std::invoke_result_t<Fn&>>) {
+        fn();
+        co_return;
+    } else {
+        co_return fn();
+    }
+}
+
+} // namespace Async
+
+#endif //ASYNCTASK_H
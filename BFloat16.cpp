@@ -0,0 +1,135 @@
+#include "BFloat16.h"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define NN_HAS_BF16_DISPATCH 1
+#endif
+
+BFloat16 BFloat16::fromFloat(const float value) {
+    std::uint32_t u;
+    std::memcpy(&u, &value, sizeof(u));
+    BFloat16 result;
+    if ((u & 0x7FFFFFFFu) > 0x7F800000u) {
+        result.bits = static_cast<std::uint16_t>((u >> 16) | 0x0040u); // keep NaN quiet
+        return result;
+    }
+    u += 0x7FFFu + ((u >> 16) & 1u);
+    result.bits = static_cast<std::uint16_t>(u >> 16);
+    return result;
+}
+
+float BFloat16::toFloat() const {
+    const std::uint32_t u = static_cast<std::uint32_t>(bits) << 16;
+    float value;
+    std::memcpy(&value, &u, sizeof(value));
+    return value;
+}
+
+#ifdef NN_HAS_BF16_DISPATCH
+__attribute__((target("avx512f,avx512bw,avx512bf16")))
+static float dotAvx512BF16(const BFloat16* a, const BFloat16* b, const std::size_t count) {
+    __m512 acc = _mm512_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        const __m512i va = _mm512_loadu_si512(a + i);
+        const __m512i vb = _mm512_loadu_si512(b + i);
+        acc = _mm512_dpbf16_ps(acc, (__m512bh) va, (__m512bh) vb);
+    }
+    if (i < count) {
+        const __mmask32 tail = (1u << (count - i)) - 1u; // count - i < 32
+        const __m512i va = _mm512_maskz_loadu_epi16(tail, a + i);
+        const __m512i vb = _mm512_maskz_loadu_epi16(tail, b + i);
+        acc = _mm512_dpbf16_ps(acc, (__m512bh) va, (__m512bh) vb);
+    }
+    // Summed pairwise from memory: GCC 12's _mm512_reduce_add_ps and _mm512_extract* trip -Wuninitialized
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, acc);
+    for (std::size_t width = 8; width > 0; width /= 2) {
+        for (std::size_t k = 0; k < width; ++k) {
+            lanes[k] += lanes[k + width];
+        }
+    }
+    return lanes[0];
+}
+#endif
+
+static float dotEmulated(const BFloat16* a, const BFloat16* b, const std::size_t count) {
+    // Independent partial sums so the compiler can vectorize the fp32 accumulation
+    float partial[8] = {};
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        for (std::size_t k = 0; k < 8; ++k) {
+            partial[k] += a[i + k].toFloat() * b[i + k].toFloat();
+        }
+    }
+    float sum = 0.0f;
+    for (; i < count; ++i) {
+        sum += a[i].toFloat() * b[i].toFloat();
+    }
+    for (const float p : partial) {
+        sum += p;
+    }
+    return sum;
+}
+
+bool MixedPrecision::hasNativeBF16() {
+#ifdef NN_HAS_BF16_DISPATCH
+    static const bool supported = __builtin_cpu_supports("avx512bf16");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+void MixedPrecision::toBFloat16(const double* src, BFloat16* dst, const std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        dst[i] = BFloat16::fromFloat(static_cast<float>(src[i]));
+    }
+}
+
+std::vector<BFloat16> MixedPrecision::toBFloat16(const std::vector<double>& vec) {
+    std::vector<BFloat16> result(vec.size());
+    toBFloat16(vec.data(), result.data(), vec.size());
+    return result;
+}
+
+void MixedPrecision::toDouble(const BFloat16* src, double* dst, const std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        dst[i] = static_cast<double>(src[i].toFloat());
+    }
+}
+
+float MixedPrecision::dot(const BFloat16* a, const BFloat16* b, const std::size_t count) {
+#ifdef NN_HAS_BF16_DISPATCH
+    if (hasNativeBF16()) {
+        return dotAvx512BF16(a, b, count);
+    }
+#endif
+    return dotEmulated(a, b, count);
+}
+
+void MixedPrecision::multiplyMatrixVector(const std::vector<BFloat16>& matrix, const std::vector<BFloat16>& vec,
+                                          std::vector<double>& result) {
+    const std::size_t cols = vec.size();
+    if (cols == 0 || matrix.size() != result.size() * cols) {
+        std::ostringstream oss;
+        oss << "BF16 matrix and vector dimensions are incompatible. "
+            << "Matrix elements: " << matrix.size() << ", "
+            << "Rows: " << result.size() << ", "
+            << "Vector size: " << cols;
+        throw std::invalid_argument(oss.str());
+    }
+
+    ThreadPool::instance().parallelFor(result.size(), 2.0 * static_cast<double>(cols),
+        [&](const std::size_t begin, const std::size_t end) {
+            for (std::size_t row = begin; row < end; ++row) {
+                result[row] = dot(matrix.data() + row * cols, vec.data(), cols);
+            }
+        });
+}
@@ -0,0 +1,34 @@
+#ifndef BFLOAT16_H
+#define BFLOAT16_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// 16-bit brain floating point: the upper half of an IEEE float, same exponent range as fp32
+struct BFloat16 {
+    std::uint16_t bits = 0;
+
+    static BFloat16 fromFloat(float value); // round-to-nearest-even
+    [[nodiscard]] float toFloat() const;
+};
+
+class MixedPrecision {
+public:
+    // True when the CPU executes AVX-512 BF16 dot products natively, otherwise they are emulated
+    static bool hasNativeBF16();
+
+    static void toBFloat16(const double* src, BFloat16* dst, std::size_t count);
+    static std::vector<BFloat16> toBFloat16(const std::vector<double>& vec);
+    // Exact, every bf16 value is a double
+    static void toDouble(const BFloat16* src, double* dst, std::size_t count);
+
+    // bf16 x bf16 products accumulated in fp32
+    static float dot(const BFloat16* a, const BFloat16* b, std::size_t count);
+
+    // matrix is row-major with result.size() rows of vec.size() columns
+    static void multiplyMatrixVector(const std::vector<BFloat16>& matrix, const std::vector<BFloat16>& vec,
+                                     std::vector<double>& result);
+};
+
+#endif //BFLOAT16_H
@@ -0,0 +1,77 @@
+#include "Checkpointer.h"
+
+#include <utility>
+
+#include "NeuralNetwork.h"
+#include "UtilityFunctions.h"
+
+Checkpointer::Checkpointer(std::string path) : target(std::move(path)) {
+    writer = std::thread(&Checkpointer::writerLoop, this);
+}
+
+Checkpointer::~Checkpointer() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    writer.join();
+}
+
+void Checkpointer::save(const NeuralNetwork& network) {
+    network.checkpointState(staging);
+    {
+        std::lock_guard lock(mutex);
+        rethrowError();
+        // The buffer swapped out is reused by the next save, a checkpoint never queued twice is simply dropped
+        std::swap(staging, queued);
+        hasQueued = true;
+    }
+    changed.notify_all();
+}
+
+void Checkpointer::flush() {
+    std::unique_lock lock(mutex);
+    changed.wait(lock, [&] { return (!hasQueued && !writing) || error; });
+    rethrowError();
+}
+
+std::uint64_t Checkpointer::written() const {
+    std::lock_guard lock(mutex);
+    return writtenCount;
+}
+
+void Checkpointer::rethrowError() {
+    if (error) {
+        std::rethrow_exception(std::exchange(error, nullptr));
+    }
+}
+
+void Checkpointer::writerLoop() {
+    std::vector<char> active;
+    std::unique_lock lock(mutex);
+    while (true) {
+        changed.wait(lock, [&] { return hasQueued || stopping; });
+        if (!hasQueued) {
+            return;
+        }
+        std::swap(active, queued);
+        hasQueued = false;
+        writing = true;
+        lock.unlock();
+        std::exception_ptr failure;
+        try {
+            UtilityFunctions::writeFileAtomic(target, active.data(), active.size());
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        lock.lock();
+        writing = false;
+        if (failure) {
+            error = failure;
+        } else {
+            writtenCount++;
+        }
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef CHECKPOINTER_H
+#define CHECKPOINTER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class NeuralNetwork;
+
+// Periodic training checkpoints that do not stall the training loop. save() serializes the network into
+// a memory buffer on the calling thread; a background thread writes it with fsync and an atomic rename.
+// If the disk falls behind, a checkpoint still waiting to be written is replaced by the newer one.
+class Checkpointer {
+public:
+    explicit Checkpointer(std::string path);
+    // Writes whatever is still queued
+    ~Checkpointer();
+
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    // A failed background write is rethrown by the next save() or flush()
+    void save(const NeuralNetwork& network);
+    // Blocks until every queued checkpoint is on disk
+    void flush();
+
+    [[nodiscard]] const std::string& path() const { return target; }
+    [[nodiscard]] std::uint64_t written() const;
+
+private:
+    std::string target;
+    std::vector<char> staging; // filled by save() without holding the lock
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<char> queued;
+    bool hasQueued = false;
+    bool writing = false;
+    bool stopping = false;
+    std::uint64_t writtenCount = 0;
+    std::exception_ptr error;
+    std::thread writer;
+
+    void rethrowError();
+    void writerLoop();
+};
+
+#endif //CHECKPOINTER_H
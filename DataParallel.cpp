@@ -0,0 +1,131 @@
+#include "DataParallel.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Dataset.h"
+#include "NeuralNetwork.h"
+#include "SharedMemoryAllreduce.h"
+#include "SystemTopology.h"
+#include "ThreadPool.h"
+#include "UtilityFunctions.h"
+
+#ifdef __linux__
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Runs in the child right after fork(): a fresh pool on this rank's share of the CPUs
+static void prepareChild(const std::size_t rank, const std::size_t processes) {
+    ThreadPool::reinitializeAfterFork();
+    const SystemTopology topology = SystemTopology::detect();
+    ThreadPoolConfig config = ThreadPoolConfig::fromEnvironment();
+    if (topology.cpus.size() >= processes) {
+        const std::size_t begin = rank * topology.cpus.size() / processes;
+        const std::size_t end = (rank + 1) * topology.cpus.size() / processes;
+        SystemTopology::restrictCurrentThread({topology.cpus.begin() + begin, topology.cpus.begin() + end});
+    }
+    if (config.threads == 0) {
+        config.threads = std::max<std::size_t>(1, topology.recommendedThreads() / processes);
+    }
+    ThreadPool::configure(config);
+    // The forked thread runs this rank's training loop
+    ThreadPool::instance().pinCallingThread();
+    if (rank != 0) {
+        // Rank 0 reports progress for everyone
+        std::cout.setstate(std::ios::badbit);
+    }
+}
+
+void DataParallel::launch(const std::size_t processes, const std::size_t allreduceCount,
+                          const std::function<void(std::size_t rank, SharedMemoryAllreduce& allreduce)>& body) {
+    if (processes == 0) {
+        throw std::invalid_argument("Data-parallel training needs at least one process.");
+    }
+    SharedMemoryAllreduce allreduce(processes, allreduceCount);
+#ifdef __linux__
+    std::cout.flush();
+    std::vector<pid_t> children;
+    const auto killChildren = [&] {
+        for (const pid_t child : children) {
+            ::kill(child, SIGKILL);
+        }
+        for (const pid_t child : children) {
+            ::waitpid(child, nullptr, 0);
+        }
+    };
+    for (std::size_t rank = 0; rank < processes; ++rank) {
+        const pid_t child = ::fork();
+        if (child < 0) {
+            killChildren();
+            throw std::runtime_error("Unable to start training process " + std::to_string(rank) + ".");
+        }
+        if (child == 0) {
+            int status = 0;
+            try {
+                prepareChild(rank, processes);
+                allreduce.setRank(rank);
+                body(rank, allreduce);
+                std::cout.flush();
+            } catch (const std::exception& e) {
+                std::cerr << "Training process " << rank << " failed: " << e.what() << std::endl;
+                status = 1;
+            } catch (...) {
+                // Anything else must not unwind into the copy of the parent's stack either
+                std::cerr << "Training process " << rank << " failed." << std::endl;
+                status = 1;
+            }
+            // Skip the parent's atexit handlers and static destructors, they belong to the parent
+            ::_exit(status);
+        }
+        children.push_back(child);
+    }
+    // A failed rank leaves its peers blocked in the allreduce, so stop them all on the first failure
+    while (!children.empty()) {
+        int status = 0;
+        const pid_t child = ::waitpid(-1, &status, 0);
+        if (child < 0) {
+            killChildren();
+            throw std::runtime_error("Lost track of the training processes.");
+        }
+        std::erase(children, child);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            killChildren();
+            throw std::runtime_error("A training process failed.");
+        }
+    }
+#else
+    if (processes != 1) {
+        throw std::runtime_error("Multi-process training is only supported on Linux.");
+    }
+    body(0, allreduce);
+#endif
+}
+
+void DataParallel::train(NeuralNetwork& network, const Dataset& data, const int epochs, const std::size_t processes,
+                         const Dataset* validation) {
+    // The children's copies of a publisher or checkpointer have no background threads behind them
+    network.publishSnapshots(nullptr, 0);
+    network.setCheckpointer(nullptr, 0);
+    const std::string resultPath = (std::filesystem::temp_directory_path() /
+                                    ("nn-replica-" + std::to_string(std::random_device{}()) + ".bin")).string();
+    launch(processes, network.parameterCount() + 1, [&](const std::size_t rank, SharedMemoryAllreduce& allreduce) {
+        network.trainReplica(data, epochs, allreduce, validation);
+        if (rank == 0) {
+            std::vector<char> state;
+            network.checkpointState(state);
+            UtilityFunctions::writeFileAtomic(resultPath, state.data(), state.size());
+        }
+    });
+    const std::vector<char> state = UtilityFunctions::readFile(resultPath);
+    std::filesystem::remove(resultPath);
+    // Into the caller's network, so its runtime settings survive
+    network.loadCheckpointState(state, resultPath);
+}
@@ -0,0 +1,28 @@
+#ifndef DATAPARALLEL_H
+#define DATAPARALLEL_H
+
+#include <cstddef>
+#include <functional>
+
+class Dataset;
+class NeuralNetwork;
+class SharedMemoryAllreduce;
+
+// Data-parallel training across processes of one host. Each process gets its own replica, a contiguous
+// slice of the CPUs (so with NUMA-ordered CPUs a process stays on one node) and its own thread pool.
+// Replicas stay identical because every step applies the same allreduce-averaged gradients.
+class DataParallel {
+public:
+    // Forks processes children running body(rank, allreduce) and waits for all of them. Children exit without
+    // returning; if one fails the others are killed and this throws. allreduceCount sizes the shared buffers.
+    static void launch(std::size_t processes, std::size_t allreduceCount,
+                       const std::function<void(std::size_t rank, SharedMemoryAllreduce& allreduce)>& body);
+
+    // Trains network on data with processes replicas (NeuralNetwork::trainReplica), then loads the trained
+    // weights and training state of rank 0 back into network, keeping its other settings. Snapshot publishing and checkpointing attached to network are not
+    // carried into the children and are detached on return.
+    static void train(NeuralNetwork& network, const Dataset& data, int epochs, std::size_t processes,
+                      const Dataset* validation = nullptr);
+};
+
+#endif //DATAPARALLEL_H
@@ -0,0 +1,122 @@
+#include "Dataset.h"
+
+#include <charconv>
+#include <fstream>
+#include <stdexcept>
+
+static constexpr double PixelScale = 1.0 / 255.0;
+
+Dataset::Dataset(const std::size_t featureCount, const std::size_t classCount)
+    : featuresPerSample(featureCount), classes(classCount) {
+}
+
+// Parses one unsigned field ending at ',' or the end of the line and checks it fits in a byte
+static std::uint8_t parseByte(const char*& cursor, const char* end, const std::string& filename) {
+    unsigned value = 0;
+    const auto [next, error] = std::from_chars(cursor, end, value);
+    if (error != std::errc() || value > 255) {
+        throw std::runtime_error("Invalid 8-bit value in " + filename + ": " + std::string(cursor, end));
+    }
+    cursor = next < end && *next == ',' ? next + 1 : next;
+    return static_cast<std::uint8_t>(value);
+}
+
+bool Dataset::parseCsvRow(std::string_view line, const bool hasLabels, const std::size_t classCount,
+                          std::uint8_t* pixels, const std::size_t featureCount, std::uint8_t& label,
+                          const std::string& source) {
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    if (line.empty()) {
+        return false;
+    }
+    const char* cursor = line.data();
+    const char* end = line.data() + line.size();
+    if (hasLabels) {
+        label = parseByte(cursor, end, source);
+        if (label >= classCount) {
+            throw std::invalid_argument("Invalid label value " + std::to_string(label) + " in " + source);
+        }
+    }
+    for (std::size_t i = 0; i < featureCount; ++i) {
+        if (cursor >= end) {
+            throw std::runtime_error("Row has fewer than " + std::to_string(featureCount) + " pixels in " + source);
+        }
+        pixels[i] = parseByte(cursor, end, source);
+    }
+    return true;
+}
+
+Dataset Dataset::loadCsv(const std::string& filename, const bool hasLabels, const std::size_t classCount) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open file: " + filename);
+    }
+
+    // Skip the first line (header), it also tells us the number of columns
+    std::string line;
+    if (!std::getline(file, line)) {
+        throw std::runtime_error("File is empty or unable to read header: " + filename);
+    }
+    std::size_t columns = 1;
+    for (const char c : line) {
+        columns += c == ',';
+    }
+    const std::size_t featureCount = hasLabels ? columns - 1 : columns;
+
+    Dataset dataset(featureCount, classCount);
+    std::vector<std::uint8_t> row(featureCount);
+    while (std::getline(file, line)) {
+        std::uint8_t label = 0;
+        if (!parseCsvRow(line, hasLabels, classCount, row.data(), featureCount, label, filename)) {
+            continue;
+        }
+        if (hasLabels) {
+            dataset.addSample(row.data(), label);
+        } else {
+            dataset.pixelData.insert(dataset.pixelData.end(), row.begin(), row.end());
+            dataset.sampleCount++;
+        }
+    }
+    dataset.pixelData.shrink_to_fit();
+    dataset.labels.shrink_to_fit();
+    return dataset;
+}
+
+void Dataset::addSample(const std::uint8_t* pixels, const std::uint8_t label) {
+    pixelData.insert(pixelData.end(), pixels, pixels + featuresPerSample);
+    labels.push_back(label);
+    sampleCount++;
+}
+
+void Dataset::clear() {
+    pixelData.clear();
+    labels.clear();
+    sampleCount = 0;
+}
+
+void Dataset::features(const std::size_t sample, std::vector<double>& out) const {
+    out.resize(featuresPerSample);
+    const std::uint8_t* source = pixels(sample);
+    for (std::size_t i = 0; i < featuresPerSample; ++i) {
+        out[i] = source[i] * PixelScale;
+    }
+}
+
+Dataset Dataset::takeTail(const std::size_t count) {
+    if (count > sampleCount) {
+        throw std::invalid_argument("Cannot take " + std::to_string(count) + " samples from a dataset of " +
+                                    std::to_string(sampleCount));
+    }
+    Dataset tail(featuresPerSample, classes);
+    const std::size_t first = sampleCount - count;
+    tail.pixelData.assign(pixelData.begin() + static_cast<std::ptrdiff_t>(first * featuresPerSample), pixelData.end());
+    pixelData.resize(first * featuresPerSample);
+    if (!labels.empty()) {
+        tail.labels.assign(labels.begin() + static_cast<std::ptrdiff_t>(first), labels.end());
+        labels.resize(first);
+    }
+    tail.sampleCount = count;
+    sampleCount = first;
+    return tail;
+}
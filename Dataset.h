@@ -0,0 +1,51 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Columnar in-memory image dataset: one contiguous uint8 pixel buffer (sample-major) and one uint8
+// class index per sample. Samples are normalized to [0, 1] only when their features are read.
+class Dataset {
+public:
+    Dataset() = default;
+    Dataset(std::size_t featureCount, std::size_t classCount);
+
+    // CSV with a header line, "label,p0,p1,..." rows, or just pixels when hasLabels is false
+    static Dataset loadCsv(const std::string& filename, bool hasLabels, std::size_t classCount = 10);
+
+    // Parses one CSV row into pixels (and label); false for a blank line. source names the input in errors
+    static bool parseCsvRow(std::string_view line, bool hasLabels, std::size_t classCount, std::uint8_t* pixels,
+                            std::size_t featureCount, std::uint8_t& label, const std::string& source);
+
+    void addSample(const std::uint8_t* pixels, std::uint8_t label);
+    // Drops every sample but keeps the buffers, so a refilled batch does not reallocate
+    void clear();
+
+    [[nodiscard]] std::size_t size() const { return sampleCount; }
+    [[nodiscard]] bool empty() const { return sampleCount == 0; }
+    [[nodiscard]] std::size_t featureCount() const { return featuresPerSample; }
+    [[nodiscard]] std::size_t classCount() const { return classes; }
+    [[nodiscard]] bool hasLabels() const { return labels.size() == sampleCount && sampleCount > 0; }
+
+    [[nodiscard]] const std::uint8_t* pixels(std::size_t sample) const { return pixelData.data() + sample * featuresPerSample; }
+    [[nodiscard]] std::uint8_t label(std::size_t sample) const { return labels[sample]; }
+
+    // Normalized features of one sample, out is resized to featureCount()
+    void features(std::size_t sample, std::vector<double>& out) const;
+
+    // Moves the last count samples into a new dataset, e.g. for a validation split
+    Dataset takeTail(std::size_t count);
+
+private:
+    std::vector<std::uint8_t> pixelData;
+    std::vector<std::uint8_t> labels;
+    std::size_t featuresPerSample = 0;
+    std::size_t classes = 0;
+    std::size_t sampleCount = 0;
+};
+
+#endif //DATASET_H
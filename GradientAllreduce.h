@@ -0,0 +1,31 @@
+#ifndef GRADIENTALLREDUCE_H
+#define GRADIENTALLREDUCE_H
+
+#include <cstddef>
+
+// Element-wise mean of a double vector across the replicas of a data-parallel run. Ranges may be submitted
+// while the caller is still producing the rest of the vector, so transports with their own progress thread
+// overlap communication with the backward pass. Every rank must submit the same ranges in the same order.
+class GradientAllreduce {
+public:
+    virtual ~GradientAllreduce() = default;
+
+    [[nodiscard]] virtual std::size_t rank() const = 0;
+    [[nodiscard]] virtual std::size_t size() const = 0;
+    // Length of the vectors being averaged
+    [[nodiscard]] virtual std::size_t count() const = 0;
+    // Ranges at least this long are worth sending on their own, shorter ones are merged with their neighbours
+    [[nodiscard]] virtual std::size_t bucketElements() const { return count(); }
+
+    // Starts replacing values[begin, end) with its mean over all ranks; values must stay alive until wait()
+    virtual void submit(double* values, std::size_t begin, std::size_t end) = 0;
+    // Blocks until every submitted range is averaged, rethrowing a transport failure
+    virtual void wait() = 0;
+
+    void average(double* values) {
+        submit(values, 0, count());
+        wait();
+    }
+};
+
+#endif //GRADIENTALLREDUCE_H
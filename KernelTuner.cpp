@@ -0,0 +1,224 @@
+#include "KernelTuner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+#include "UtilityFunctions.h"
+
+namespace {
+    // Work timed per trial, small shapes repeat the kernel until they reach it
+    constexpr double TimedFlops = 4.0e6;
+    // Best of this many trials, so a preempted trial does not decide
+    constexpr int Trials = 5;
+
+    // Rows [first, first + Block) of matrix * x + bias in one pass over x. Each row still sums its products
+    // left to right and adds the bias last, exactly like a row on its own.
+    template <std::size_t Block>
+    void multiplyRows(const std::vector<std::vector<double>>& matrix, const double* x, const std::size_t cols,
+                      const double* bias, double* z, const std::size_t first) {
+        const double* rows[Block];
+        double sums[Block] = {};
+        for (std::size_t b = 0; b < Block; ++b) {
+            rows[b] = matrix[first + b].data();
+        }
+        for (std::size_t j = 0; j < cols; ++j) {
+            for (std::size_t b = 0; b < Block; ++b) {
+                sums[b] += rows[b][j] * x[j];
+            }
+        }
+        for (std::size_t b = 0; b < Block; ++b) {
+            z[first + b] = sums[b] + bias[first + b];
+        }
+    }
+}
+
+KernelTuner::KernelTuner(std::string path) : file(std::move(path)) {
+    const ThreadPool& pool = ThreadPool::instance();
+    cpuModel = pool.topology().cpuModel;
+    threads = pool.size();
+    load();
+}
+
+KernelTuner& KernelTuner::instance() {
+    static KernelTuner tuner([] {
+        const char* path = std::getenv("NN_TUNING_FILE");
+        return std::string(path != nullptr && *path != '\0' ? path : "kernel_tuning.tsv");
+    }());
+    return tuner;
+}
+
+MatVecConfig KernelTuner::matVec(const std::size_t rows, const std::size_t cols) {
+    std::lock_guard lock(mutex);
+    const Key key{cpuModel, threads, rows, cols};
+    if (const auto found = entries.find(key); found != entries.end()) {
+        return found->second;
+    }
+    const MatVecConfig config = benchmark(rows, cols);
+    entries[key] = config;
+    save();
+    return config;
+}
+
+MatVecConfig KernelTuner::tune(const std::size_t rows, const std::size_t cols) {
+    std::lock_guard lock(mutex);
+    const MatVecConfig config = benchmark(rows, cols);
+    entries[Key{cpuModel, threads, rows, cols}] = config;
+    save();
+    return config;
+}
+
+std::optional<MatVecConfig> KernelTuner::cached(const std::size_t rows, const std::size_t cols) const {
+    std::lock_guard lock(mutex);
+    if (const auto found = entries.find(Key{cpuModel, threads, rows, cols}); found != entries.end()) {
+        return found->second;
+    }
+    return std::nullopt;
+}
+
+void KernelTuner::multiplyAdd(const std::vector<std::vector<double>>& matrix, const std::vector<double>& x,
+                              const std::vector<double>& bias, std::vector<double>& z, const MatVecConfig& config) {
+    if (matrix.empty() || x.empty() || matrix[0].size() != x.size()) {
+        std::ostringstream oss;
+        oss << "Matrix and vector dimensions are incompatible. "
+            << "Matrix dimensions: " << matrix.size() << "x" << (matrix.empty() ? 0 : matrix[0].size()) << ", "
+            << "Vector size: " << x.size() << "x1";
+        throw std::invalid_argument(oss.str());
+    }
+    if (bias.size() != matrix.size()) {
+        throw std::invalid_argument("Vector dimensions mismatch: vec1 size = " + std::to_string(matrix.size()) +
+                                    ", vec2 size = " + std::to_string(bias.size()));
+    }
+    const std::size_t rows = matrix.size();
+    const std::size_t cols = x.size();
+    z.resize(rows);
+
+    const auto body = [&](const std::size_t begin, const std::size_t end) {
+        std::size_t row = begin;
+        if (config.rowBlock >= 4) {
+            for (; row + 4 <= end; row += 4) {
+                multiplyRows<4>(matrix, x.data(), cols, bias.data(), z.data(), row);
+            }
+        }
+        if (config.rowBlock >= 2) {
+            for (; row + 2 <= end; row += 2) {
+                multiplyRows<2>(matrix, x.data(), cols, bias.data(), z.data(), row);
+            }
+        }
+        for (; row < end; ++row) {
+            multiplyRows<1>(matrix, x.data(), cols, bias.data(), z.data(), row);
+        }
+    };
+    ThreadPool& pool = ThreadPool::instance();
+    if (config.grain == 0) {
+        pool.parallelFor(rows, 2.0 * static_cast<double>(cols) + 1.0, body);
+    } else {
+        pool.parallelForGrain(rows, config.grain, body);
+    }
+}
+
+MatVecConfig KernelTuner::benchmark(const std::size_t rows, const std::size_t cols) const {
+    if (rows == 0 || cols == 0) {
+        throw std::invalid_argument("Layer shape must be positive");
+    }
+    // Synthetic operands of the layer's shape, only their size matters to the timing
+    std::vector<std::vector<double>> matrix(rows, std::vector<double>(cols));
+    for (std::size_t i = 0; i < rows; ++i) {
+        for (std::size_t j = 0; j < cols; ++j) {
+            matrix[i][j] = static_cast<double>((i * cols + j) % 17) * 0.01 - 0.08;
+        }
+    }
+    const std::vector<double> x(cols, 0.5);
+    const std::vector<double> bias(rows, 0.1);
+    std::vector<double> z;
+
+    // The pool heuristic first, so it keeps ties; then serial and 1, 2 or 4 tasks per participant
+    std::vector<std::size_t> grains = {0, rows};
+    const std::size_t participants = ThreadPool::instance().size();
+    if (participants > 1) {
+        for (const std::size_t tasksPerParticipant : {1, 2, 4}) {
+            const std::size_t tasks = participants * tasksPerParticipant;
+            grains.push_back((rows + tasks - 1) / tasks);
+        }
+    }
+    std::vector<MatVecConfig> candidates;
+    for (const std::size_t rowBlock : {1, 2, 4}) {
+        for (const std::size_t grain : grains) {
+            // Tasks are whole blocks, so no block straddles two of them
+            MatVecConfig candidate{rowBlock, grain == 0 ? 0 : (grain + rowBlock - 1) / rowBlock * rowBlock};
+            const bool seen = std::ranges::any_of(candidates, [&](const MatVecConfig& other) {
+                return other.rowBlock == candidate.rowBlock && other.grain == candidate.grain;
+            });
+            if (!seen) {
+                candidates.push_back(candidate);
+            }
+        }
+    }
+
+    const double flops = 2.0 * static_cast<double>(rows) * static_cast<double>(cols);
+    const std::size_t repeats = std::max<std::size_t>(1, static_cast<std::size_t>(TimedFlops / flops));
+    MatVecConfig best;
+    double bestSeconds = std::numeric_limits<double>::infinity();
+    for (const MatVecConfig& candidate : candidates) {
+        multiplyAdd(matrix, x, bias, z, candidate); // warm the caches and the workers
+        for (int trial = 0; trial < Trials; ++trial) {
+            const auto start = std::chrono::steady_clock::now();
+            for (std::size_t repeat = 0; repeat < repeats; ++repeat) {
+                multiplyAdd(matrix, x, bias, z, candidate);
+            }
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (seconds < bestSeconds) {
+                best = candidate;
+                bestSeconds = seconds;
+            }
+        }
+    }
+    return best;
+}
+
+void KernelTuner::load() {
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::vector<std::string> fields;
+        std::istringstream stream(line);
+        for (std::string field; std::getline(stream, field, '\t');) {
+            fields.push_back(field);
+        }
+        if (fields.size() != 6) {
+            continue;
+        }
+        try {
+            const Key key{fields[0], std::stoull(fields[1]), std::stoull(fields[2]), std::stoull(fields[3])};
+            entries[key] = MatVecConfig{std::stoull(fields[4]), std::stoull(fields[5])};
+        } catch (const std::exception&) {
+            // A damaged line only costs its shape a new benchmark
+        }
+    }
+}
+
+void KernelTuner::save() const {
+    std::ostringstream out;
+    out << "# cpu model\tthreads\trows\tcols\trow block\tgrain\n";
+    for (const auto& [key, config] : entries) {
+        const auto& [model, poolThreads, rows, cols] = key;
+        out << model << '\t' << poolThreads << '\t' << rows << '\t' << cols << '\t' << config.rowBlock << '\t'
+            << config.grain << '\n';
+    }
+    const std::string contents = out.str();
+    try {
+        UtilityFunctions::writeFileAtomic(file, contents.data(), contents.size());
+    } catch (const std::exception& e) {
+        // Tuning still applies to this run, the next one benchmarks again
+        std::cerr << "Unable to save kernel tuning cache: " << e.what() << std::endl;
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef KERNELTUNER_H
+#define KERNELTUNER_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// How the fp64 W * x + b of one layer is split and blocked
+struct MatVecConfig {
+    std::size_t rowBlock = 1; // rows computed together in one pass over x
+    std::size_t grain = 0;    // rows per parallel task, 0: the pool's FLOP heuristic, >= rows: serial
+};
+
+// Picks a MatVecConfig per layer shape by timing every candidate on this machine, and remembers the winners in
+// a tab-separated file keyed by CPU model, pool size and shape, so later runs skip the benchmark. Entries of
+// other machines sharing the file are kept. Every candidate computes each row's dot product in the same order,
+// so the choice never changes a result, only how fast it arrives.
+class KernelTuner {
+public:
+    // Loads the cache at path if there is one, a missing or unreadable file starts empty
+    explicit KernelTuner(std::string path);
+
+    // The shared tuner, its file is NN_TUNING_FILE or kernel_tuning.tsv
+    static KernelTuner& instance();
+
+    // The cached config of this shape, benchmarked and saved on first use
+    MatVecConfig matVec(std::size_t rows, std::size_t cols);
+    // Benchmarks the shape again and replaces its cached config
+    MatVecConfig tune(std::size_t rows, std::size_t cols);
+    [[nodiscard]] std::optional<MatVecConfig> cached(std::size_t rows, std::size_t cols) const;
+    [[nodiscard]] const std::string& path() const { return file; }
+
+    // z = matrix * x + bias split and blocked as config says, bit-identical for every config
+    static void multiplyAdd(const std::vector<std::vector<double>>& matrix, const std::vector<double>& x,
+                            const std::vector<double>& bias, std::vector<double>& z, const MatVecConfig& config);
+
+private:
+    using Key = std::tuple<std::string, std::size_t, std::size_t, std::size_t>; // cpu model, threads, rows, cols
+
+    std::string file;
+    std::string cpuModel;
+    std::size_t threads;
+    mutable std::mutex mutex;
+    std::map<Key, MatVecConfig> entries;
+
+    void load();
+    void save() const;
+    [[nodiscard]] MatVecConfig benchmark(std::size_t rows, std::size_t cols) const;
+};
+
+#endif //KERNELTUNER_H
@@ -0,0 +1,91 @@
+#include "MemoryPlan.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+static std::size_t alignUp(const std::size_t bytes) {
+    return (bytes + MemoryPlan::Alignment - 1) / MemoryPlan::Alignment * MemoryPlan::Alignment;
+}
+
+std::size_t MemoryPlan::add(std::string name, const std::size_t bytes, const std::size_t firstStep,
+                            const std::size_t lastStep) {
+    if (lastStep < firstStep) {
+        throw std::invalid_argument("Buffer " + name + " is read before it is written");
+    }
+    planned.push_back(Buffer{std::move(name), bytes, firstStep, lastStep, 0});
+    arenaBytes = 0;
+    return planned.size() - 1;
+}
+
+void MemoryPlan::assignOffsets() {
+    std::vector<std::size_t> order(planned.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](const std::size_t a, const std::size_t b) {
+        return planned[a].bytes > planned[b].bytes;
+    });
+
+    arenaBytes = 0;
+    std::vector<std::size_t> placed;
+    std::vector<std::pair<std::size_t, std::size_t>> taken; // [offset, end) of live placed buffers
+    for (const std::size_t id : order) {
+        Buffer& current = planned[id];
+        taken.clear();
+        for (const std::size_t other : placed) {
+            const Buffer& b = planned[other];
+            if (b.firstStep <= current.lastStep && current.firstStep <= b.lastStep) {
+                taken.emplace_back(b.offset, b.offset + alignUp(b.bytes));
+            }
+        }
+        std::sort(taken.begin(), taken.end());
+        // Lowest gap between the colliding buffers that is large enough
+        std::size_t offset = 0;
+        for (const auto& [begin, end] : taken) {
+            if (offset + alignUp(current.bytes) <= begin) {
+                break;
+            }
+            offset = std::max(offset, end);
+        }
+        current.offset = offset;
+        arenaBytes = std::max(arenaBytes, offset + alignUp(current.bytes));
+        placed.push_back(id);
+    }
+}
+
+std::size_t MemoryPlan::totalBytes() const {
+    std::size_t total = 0;
+    for (const Buffer& b : planned) {
+        total += alignUp(b.bytes);
+    }
+    return total;
+}
+
+std::size_t MemoryPlan::liveBytesBound() const {
+    std::size_t lastStep = 0;
+    for (const Buffer& b : planned) {
+        lastStep = std::max(lastStep, b.lastStep);
+    }
+    std::vector<std::size_t> live(planned.empty() ? 0 : lastStep + 1, 0);
+    for (const Buffer& b : planned) {
+        for (std::size_t step = b.firstStep; step <= b.lastStep; ++step) {
+            live[step] += alignUp(b.bytes);
+        }
+    }
+    return live.empty() ? 0 : *std::max_element(live.begin(), live.end());
+}
+
+void MemoryPlan::print(std::ostream& out) const {
+    std::vector<const Buffer*> byOffset;
+    for (const Buffer& b : planned) {
+        byOffset.push_back(&b);
+    }
+    std::stable_sort(byOffset.begin(), byOffset.end(), [](const Buffer* a, const Buffer* b) {
+        return a->offset < b->offset;
+    });
+    for (const Buffer* b : byOffset) {
+        out << "  " << b->name << ": " << b->bytes << " bytes at " << b->offset << ", steps " << b->firstStep
+            << "-" << b->lastStep << "\n";
+    }
+    out << "Planned peak " << arenaBytes << " bytes (" << totalBytes() << " without reuse, "
+        << liveBytesBound() << " live at most)" << std::endl;
+}
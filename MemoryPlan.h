@@ -0,0 +1,46 @@
+#ifndef MEMORYPLAN_H
+#define MEMORYPLAN_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Static placement of buffers whose sizes and lifetimes are known up front, e.g. from a fixed layer graph.
+// Every buffer gets an offset in one arena; buffers live at the same time never share bytes, the others may.
+// Placement is greedy by size: the largest buffers go first, each at the lowest aligned offset that does not
+// collide with an already placed buffer whose lifetime overlaps its own.
+class MemoryPlan {
+public:
+    static constexpr std::size_t Alignment = 64; // every offset starts a cache line
+
+    struct Buffer {
+        std::string name;
+        std::size_t bytes = 0;
+        std::size_t firstStep = 0; // written
+        std::size_t lastStep = 0;  // last read, inclusive
+        std::size_t offset = 0;    // set by assignOffsets()
+    };
+
+    // Returns the buffer's id
+    std::size_t add(std::string name, std::size_t bytes, std::size_t firstStep, std::size_t lastStep);
+    void assignOffsets();
+
+    [[nodiscard]] const Buffer& buffer(std::size_t id) const { return planned[id]; }
+    [[nodiscard]] const std::vector<Buffer>& buffers() const { return planned; }
+    // Arena size after assignOffsets()
+    [[nodiscard]] std::size_t peakBytes() const { return arenaBytes; }
+    // Arena size if nothing were reused
+    [[nodiscard]] std::size_t totalBytes() const;
+    // Largest sum of simultaneously live buffers, no placement can go below it
+    [[nodiscard]] std::size_t liveBytesBound() const;
+
+    // One line per buffer in offset order, then the totals
+    void print(std::ostream& out) const;
+
+private:
+    std::vector<Buffer> planned;
+    std::size_t arenaBytes = 0;
+};
+
+#endif //MEMORYPLAN_H
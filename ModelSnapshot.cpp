@@ -0,0 +1,109 @@
+#include "ModelSnapshot.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+static std::atomic<bool> readerSlotInUse[SnapshotPublisher::MaxReaderThreads];
+
+std::size_t SnapshotPublisher::readerIndex() {
+    struct ThreadSlot {
+        std::size_t index = MaxReaderThreads;
+
+        ThreadSlot() {
+            for (std::size_t i = 0; i < MaxReaderThreads; ++i) {
+                if (!readerSlotInUse[i].exchange(true, std::memory_order_acquire)) {
+                    index = i;
+                    return;
+                }
+            }
+        }
+        ~ThreadSlot() {
+            if (index < MaxReaderThreads) {
+                readerSlotInUse[index].store(false, std::memory_order_release);
+            }
+        }
+    };
+    thread_local const ThreadSlot slot;
+    if (slot.index == MaxReaderThreads) {
+        throw std::runtime_error("More than " + std::to_string(MaxReaderThreads) + " snapshot reader threads.");
+    }
+    return slot.index;
+}
+
+SnapshotPublisher::SnapshotPublisher() : slots(std::make_unique<ReaderSlot[]>(MaxReaderThreads)) {
+}
+
+SnapshotPublisher::~SnapshotPublisher() {
+    // Readers must be gone by now, everything can go
+    for (const Retired& entry : retired) {
+        delete entry.snapshot;
+    }
+    delete current.load(std::memory_order_relaxed);
+}
+
+SnapshotPublisher::ReadGuard SnapshotPublisher::read() const {
+    std::atomic<std::uint64_t>& slot = slots[readerIndex()].epoch;
+    const bool outermost = slot.load(std::memory_order_relaxed) == 0;
+    if (outermost) {
+        // seq_cst orders the announcement before the load of current: if we get a snapshot the writer
+        // has already swapped out, its scan after the swap is guaranteed to see our epoch
+        slot.store(globalEpoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+    return {&slot, outermost, current.load(std::memory_order_seq_cst)};
+}
+
+SnapshotPublisher::ReadGuard::ReadGuard(ReadGuard&& other) noexcept
+    : slot(std::exchange(other.slot, nullptr)), outermost(other.outermost), snapshot(other.snapshot) {
+}
+
+SnapshotPublisher::ReadGuard::~ReadGuard() {
+    if (slot != nullptr && outermost) {
+        slot->store(0, std::memory_order_release);
+    }
+}
+
+void SnapshotPublisher::publish(const NeuralNetwork& network) {
+    auto* snapshot = new ModelSnapshot{network};
+    // The copy must not publish or checkpoint itself
+    snapshot->network.publishSnapshots(nullptr, 0);
+    snapshot->network.setCheckpointer(nullptr, 0);
+    snapshot->trainStep = network.samplesTrained();
+
+    std::lock_guard lock(writerMutex);
+    snapshot->version = ++published;
+    const ModelSnapshot* previous = current.exchange(snapshot, std::memory_order_seq_cst);
+    if (previous != nullptr) {
+        // Readers that entered at this epoch or earlier may still hold previous
+        retired.push_back({previous, globalEpoch.fetch_add(1, std::memory_order_seq_cst)});
+    }
+    reclaim();
+}
+
+void SnapshotPublisher::reclaim() {
+    std::uint64_t oldestReader = std::numeric_limits<std::uint64_t>::max();
+    for (std::size_t i = 0; i < MaxReaderThreads; ++i) {
+        const std::uint64_t epoch = slots[i].epoch.load(std::memory_order_seq_cst);
+        if (epoch != 0) {
+            oldestReader = std::min(oldestReader, epoch);
+        }
+    }
+    std::erase_if(retired, [&](const Retired& entry) {
+        if (entry.epoch >= oldestReader) {
+            return false;
+        }
+        delete entry.snapshot;
+        return true;
+    });
+}
+
+std::uint64_t SnapshotPublisher::version() const {
+    std::lock_guard lock(writerMutex);
+    return published;
+}
+
+std::size_t SnapshotPublisher::retiredCount() const {
+    std::lock_guard lock(writerMutex);
+    return retired.size();
+}
@@ -0,0 +1,93 @@
+#ifndef MODELSNAPSHOT_H
+#define MODELSNAPSHOT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "NeuralNetwork.h"
+
+// Immutable copy of a network taken between two training steps. Only its const members (infer, evaluate)
+// may be used, which keeps any number of threads reading it safely.
+struct ModelSnapshot {
+    NeuralNetwork network;
+    std::uint64_t version = 0;   // 1, 2, ... in publish order
+    std::uint64_t trainStep = 0; // samples the trainer had seen when the copy was taken
+};
+
+// Hands snapshots from a trainer to inference threads with epoch-based reclamation (RCU style). Readers
+// announce the epoch they entered in a per-thread slot and take the current snapshot with one atomic load;
+// they never lock or wait. The writer swaps in a new snapshot and frees an old one only once every reader
+// that could still hold it has left.
+class SnapshotPublisher {
+public:
+    // Threads that may hold a read guard at the same time, process wide
+    static constexpr std::size_t MaxReaderThreads = 256;
+
+    class ReadGuard {
+    public:
+        ReadGuard(ReadGuard&& other) noexcept;
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+        ReadGuard& operator=(ReadGuard&&) = delete;
+        ~ReadGuard();
+
+        // nullptr until the first publish
+        [[nodiscard]] const ModelSnapshot* get() const { return snapshot; }
+        const ModelSnapshot* operator->() const { return snapshot; }
+        const ModelSnapshot& operator*() const { return *snapshot; }
+        explicit operator bool() const { return snapshot != nullptr; }
+
+    private:
+        friend class SnapshotPublisher;
+        ReadGuard(std::atomic<std::uint64_t>* slot, bool outermost, const ModelSnapshot* snapshot)
+            : slot(slot), outermost(outermost), snapshot(snapshot) {}
+
+        std::atomic<std::uint64_t>* slot;
+        bool outermost; // nested guards on one thread keep the outer guard's (older) epoch
+        const ModelSnapshot* snapshot;
+    };
+
+    SnapshotPublisher();
+    ~SnapshotPublisher();
+
+    SnapshotPublisher(const SnapshotPublisher&) = delete;
+    SnapshotPublisher& operator=(const SnapshotPublisher&) = delete;
+
+    // The snapshot stays valid for the lifetime of the guard
+    [[nodiscard]] ReadGuard read() const;
+
+    // Copies network, makes the copy current and frees retired snapshots no reader can still see
+    void publish(const NeuralNetwork& network);
+
+    [[nodiscard]] std::uint64_t version() const;
+    // Snapshots replaced but still waiting for readers to leave
+    [[nodiscard]] std::size_t retiredCount() const;
+
+private:
+    struct alignas(64) ReaderSlot {
+        std::atomic<std::uint64_t> epoch{0}; // 0: not reading
+    };
+
+    struct Retired {
+        const ModelSnapshot* snapshot;
+        std::uint64_t epoch;
+    };
+
+    std::atomic<const ModelSnapshot*> current{nullptr};
+    std::atomic<std::uint64_t> globalEpoch{1};
+    std::unique_ptr<ReaderSlot[]> slots;
+
+    mutable std::mutex writerMutex;
+    std::vector<Retired> retired;
+    std::uint64_t published = 0;
+
+    // Index of the calling thread's reader slot, released when the thread exits
+    static std::size_t readerIndex();
+    void reclaim();
+};
+
+#endif //MODELSNAPSHOT_H
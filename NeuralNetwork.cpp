@@ -3,9 +3,22 @@
 
 #include <iostream>
 #include <stdexcept>
-#include <execution>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <numeric>
 
-NeuralNetwork::NeuralNetwork(const unsigned long long input_size): gen(std::random_device{}()), last_layer_size(input_size),
+#include "ActivationMath.h"
+#include "AsyncTask.h"
+#include "Checkpointer.h"
+#include "ModelSnapshot.h"
+#include "GradientAllreduce.h"
+#include "SystemTopology.h"
+#include "ThreadPool.h"
+#include "VectorExpression.h"
+
+NeuralNetwork::NeuralNetwork(const unsigned long long input_size): rng(std::random_device{}()), last_layer_size(input_size),
                                                     total_error(0) {
     if (input_size <= 0) {
         throw std::invalid_argument("Input size must be positive.");
@@ -16,31 +29,290 @@ void NeuralNetwork::setLearningRate(const double value) {
     this->learning_rate = value > 0 ? value : 0.01;
 }
 
-void NeuralNetwork::add_layer(const unsigned long long layer_size) {
+void NeuralNetwork::setSeed(const std::uint64_t seed) {
+    this->rng = Philox(seed);
+}
+
+void NeuralNetwork::setSharding(const ShardingConfig& config) {
+    this->sharding = config;
+}
+
+void NeuralNetwork::setActivationCheckpointing(const std::size_t every) {
+    if (every == 0) {
+        throw std::invalid_argument("Checkpoint interval must be positive");
+    }
+    this->checkpointEvery = every;
+    resetActivationStorage();
+}
+
+void NeuralNetwork::resetActivationStorage() {
+    // Rebuilt by the next forward pass with only the kept layers populated, in the precision now in use
+    std::vector<std::vector<double>>().swap(layerPreActivations);
+    std::vector<std::vector<double>>().swap(layerOutputs);
+    std::vector<std::vector<BFloat16>>().swap(layerPreActivationsBF16);
+    std::vector<std::vector<BFloat16>>().swap(layerOutputsBF16);
+    const std::size_t slots = checkpointEvery > 1 ? checkpointEvery : 0;
+    segmentPreActivations.assign(slots, {});
+    segmentOutputs.assign(slots, {});
+    segmentPreActivationsBF16.assign(slots, {});
+    segmentOutputsBF16.assign(slots, {});
+}
+
+void NeuralNetwork::setKernelAutotuning(const bool enabled) {
+    this->kernelAutotuning = enabled;
+    for (std::size_t i = 0; i < weightsMatrices.size(); ++i) {
+        const std::size_t rows = weightsMatrices[i].size();
+        layerMatVec[i] = enabled ? KernelTuner::instance().matVec(rows, weightsMatrices[i][0].size()) : MatVecConfig{};
+    }
+}
+
+std::size_t NeuralNetwork::activationBytes(const std::size_t every) const {
+    const std::size_t layers = weightsMatrices.size();
+    const std::size_t k = std::max<std::size_t>(every, 1);
+    std::size_t bytes = 0;
+    std::vector<std::size_t> slotBytes(k, 0); // largest recomputable layer sharing each segment slot
+    for (std::size_t i = 0; i < layers; ++i) {
+        // The output layer has fp64 logits only, hidden layers store bf16 with mixed precision
+        const std::size_t elementBytes = storesBF16(i) ? sizeof(BFloat16) : sizeof(double);
+        const std::size_t layerBytes = (i + 1 == layers ? 1 : 2) * weightsMatrices[i].size() * elementBytes;
+        if (k <= 1 || (i + 1) % k == 0 || i + 1 == layers) {
+            bytes += layerBytes;
+        } else {
+            slotBytes[i % k] = std::max(slotBytes[i % k], layerBytes);
+        }
+    }
+    return std::accumulate(slotBytes.begin(), slotBytes.end(), bytes);
+}
+
+std::size_t NeuralNetwork::setActivationMemoryBudget(const std::size_t bytes) {
+    if (weightsMatrices.empty()) {
+        throw std::invalid_argument("Empty network");
+    }
+    std::size_t best = 1;
+    std::size_t bestBytes = activationBytes(1);
+    for (std::size_t every = 1; every <= weightsMatrices.size(); ++every) {
+        const std::size_t needed = activationBytes(every);
+        if (needed <= bytes) {
+            best = every;
+            break;
+        }
+        if (needed < bestBytes) {
+            best = every;
+            bestBytes = needed;
+        }
+    }
+    setActivationCheckpointing(best);
+    return best;
+}
+
+MemoryPlan NeuralNetwork::planMemory(const bool training) const {
+    if (weightsMatrices.empty()) {
+        throw std::invalid_argument("Empty network");
+    }
+    const std::size_t layers = weightsMatrices.size();
+    const auto rowBytes = [&](const std::size_t layer) { return weightsMatrices[layer].size() * sizeof(double); };
+    const auto backwardStep = [&](const std::size_t layer) { return 2 * layers + (layers - 1 - layer); };
+    const std::size_t softmaxStep = 2 * layers - 1;
+
+    MemoryPlan plan;
+    if (training) {
+        plan.add("input", inputSize() * sizeof(double), 0, backwardStep(0));
+    }
+    // Inference reads the caller's input directly
+    for (std::size_t i = 0; i < layers; ++i) {
+        const std::string layer = std::to_string(i);
+        const std::size_t cols = weightsMatrices[i][0].size();
+        const bool bf16Kernel = mixedPrecision && layerSharding[i] == LayerSharding::Off;
+        const bool output = i + 1 == layers;
+        if (!training) {
+            if (bf16Kernel) {
+                plan.add("bf16 input " + layer, cols * sizeof(BFloat16), 2 * i, 2 * i);
+            }
+            plan.add("z" + layer, rowBytes(i), 2 * i, output ? softmaxStep : 2 * i + 1);
+            if (!output) {
+                plan.add("y" + layer, rowBytes(i), 2 * i + 1, 2 * i + 2);
+            }
+            continue;
+        }
+
+        // Training stores hidden activations in bf16 with mixed precision: a bf16 kernel reads the stored
+        // input as it is, an fp64 one widens it, and z and y are computed wide and narrowed after the activation
+        const bool bf16Input = i > 0 && storesBF16(i - 1);
+        const std::size_t storedBytes = weightsMatrices[i].size() * (storesBF16(i) ? sizeof(BFloat16) : sizeof(double));
+        const auto addForwardWorkspace = [&](const std::string& suffix, const std::size_t multiply,
+                                             const std::size_t activate) {
+            if (bf16Kernel && !bf16Input) {
+                plan.add("bf16 input " + layer + suffix, cols * sizeof(BFloat16), multiply, multiply);
+            } else if (!bf16Kernel && bf16Input) {
+                plan.add("wide input " + layer + suffix, cols * sizeof(double), multiply, multiply);
+            }
+            if (storesBF16(i)) {
+                plan.add("wide z" + layer + suffix, rowBytes(i), multiply, activate);
+                plan.add("wide y" + layer + suffix, rowBytes(i), activate, activate);
+            }
+        };
+        addForwardWorkspace("", 2 * i, 2 * i + 1);
+        if (keepsActivations(i)) {
+            plan.add("z" + layer, storedBytes, 2 * i, backwardStep(i));
+            if (!output) {
+                plan.add("y" + layer, storedBytes, 2 * i + 1, backwardStep(i));
+            }
+        } else {
+            // Dropped after feeding the next layer, rebuilt when backpropagation reaches the segment's end
+            const std::size_t segmentEnd = std::min((i / checkpointEvery + 1) * checkpointEvery, layers) - 1;
+            const std::size_t recompute = backwardStep(segmentEnd);
+            plan.add("z" + layer, storedBytes, 2 * i, 2 * i + 1);
+            plan.add("y" + layer, storedBytes, 2 * i + 1, 2 * i + 2);
+            addForwardWorkspace(" (recomputed)", recompute, recompute);
+            plan.add("z" + layer + " (recomputed)", storedBytes, recompute, backwardStep(i));
+            plan.add("y" + layer + " (recomputed)", storedBytes, recompute, backwardStep(i));
+        }
+        // The backward pass widens z, y and the layer's input for the derivative and the weight update
+        if (storesBF16(i)) {
+            plan.add("wide z" + layer + " (backward)", rowBytes(i), backwardStep(i), backwardStep(i));
+            plan.add("wide y" + layer + " (backward)", rowBytes(i), backwardStep(i), backwardStep(i));
+        }
+        if (bf16Input) {
+            plan.add("wide input " + layer + " (backward)", cols * sizeof(double), backwardStep(i), backwardStep(i));
+        }
+        if (layerDropout[i] > 0.0) {
+            const std::size_t words = (weightsMatrices[i].size() + MaskTile - 1) / MaskTile;
+            plan.add("mask" + layer, words * sizeof(std::uint64_t), 2 * i + 1, backwardStep(i));
+        }
+        plan.add("deltas" + layer, rowBytes(i), backwardStep(i), backwardStep(i));
+        if (i > 0) {
+            plan.add("error" + std::to_string(i - 1), cols * sizeof(double), backwardStep(i), backwardStep(i - 1));
+        }
+    }
+    if (training) {
+        plan.add("probabilities", rowBytes(layers - 1), softmaxStep, softmaxStep);
+        plan.add("output error", rowBytes(layers - 1), softmaxStep, backwardStep(layers - 1));
+    }
+    plan.assignOffsets();
+    return plan;
+}
+
+void NeuralNetwork::setMixedPrecision(const bool enabled) {
+    this->mixedPrecision = enabled;
+    resetActivationStorage();
+    if (!enabled) {
+        weightsBF16.clear();
+        return;
+    }
+    weightsBF16.resize(weightsMatrices.size());
+    for (std::size_t layer = 0; layer < weightsMatrices.size(); ++layer) {
+        syncWorkingWeights(layer);
+    }
+}
+
+void NeuralNetwork::syncWorkingWeights(const std::size_t layer) {
+    const auto& matrix = weightsMatrices[layer];
+    const std::size_t cols = matrix.empty() ? 0 : matrix[0].size();
+    auto& working = weightsBF16[layer];
+    working.resize(matrix.size() * cols);
+    for (std::size_t row = 0; row < matrix.size(); ++row) {
+        MixedPrecision::toBFloat16(matrix[row].data(), working.data() + row * cols, cols);
+    }
+}
+
+void NeuralNetwork::add_layer(const unsigned long long layer_size, const ActivationType activation) {
     if (layer_size <= 0) {
         throw std::invalid_argument("Layer size must be bigger than 0");
     }
 
     const unsigned long long cols = this->last_layer_size;
     const unsigned long long rows = layer_size;
-    weightsMatrices.emplace_back(rows, std::vector<double>(cols));
+    weightsMatrices.emplace_back(rows);
     biasVectors.emplace_back(rows, 0.0);
+    layerActivations.push_back(activation);
+    layerKernels.push_back(activationKernels(activation));
+    layerDropout.push_back(0.0);
+    layerNoise.push_back(0.0);
+    dropoutMasks.emplace_back();
 
-    auto& layerMatrix = weightsMatrices.back();
-    auto& layerBiases = biasVectors.back();
-    std::normal_distribution<> distrib(0.0, std::sqrt(1.0 / static_cast<double>(cols))); // He Initialization
+    LayerSharding layerShards = LayerSharding::Off;
+    if (sharding.mode != LayerSharding::Off && rows * cols * sizeof(double) >= sharding.thresholdBytes) {
+        layerShards = sharding.mode != LayerSharding::Auto ? sharding.mode
+                      : rows >= cols                        ? LayerSharding::Rows
+                                                            : LayerSharding::Columns;
+    }
+    layerSharding.push_back(layerShards);
+    layerMatVec.push_back(kernelAutotuning ? KernelTuner::instance().matVec(rows, cols) : MatVecConfig{});
 
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            layerMatrix[i][j] = distrib(gen);
-        }
-        layerBiases[i] = 0.0; // Initialize biases similarly
+    // Rows are first touched by the thread that multiplies them, so they land on its NUMA node.
+    // Weight (i, j) is element i * cols + j of the layer's stream, identical for any thread count.
+    auto& layerMatrix = weightsMatrices.back();
+    const double stddev = std::sqrt(1.0 / static_cast<double>(cols)); // He Initialization
+    const std::uint64_t stream = Philox::stream(Philox::WeightInit, weightsMatrices.size() - 1);
+    if (layerShards == LayerSharding::Off) {
+        ThreadPool::instance().parallelForStatic(rows, [&](const std::size_t begin, const std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                layerMatrix[i] = std::vector<double>(cols);
+                rng.normal(stream, i * cols, layerMatrix[i].data(), cols, 0.0, stddev);
+            }
+        });
+    } else if (layerShards == LayerSharding::Rows) {
+        forEachShardMember(shardCount(), [&](const ShardMember& team) {
+            const auto [begin, end] = shardRange(rows, team);
+            for (std::size_t i = begin; i < end; ++i) {
+                layerMatrix[i] = std::vector<double>(cols);
+                rng.normal(stream, i * cols, layerMatrix[i].data(), cols, 0.0, stddev);
+            }
+        });
+    } else {
+        ThreadPool::instance().parallelForStatic(rows, [&](const std::size_t begin, const std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                layerMatrix[i] = std::vector<double>(cols);
+            }
+        });
+        // Each column slice is handed back to the kernel and first touched again by the thread that owns it
+        forEachShardMember(shardCount(), [&](const ShardMember& team) {
+            const auto [begin, end] = shardRange(cols, team);
+            for (std::size_t i = 0; i < rows; ++i) {
+                SystemTopology::releasePages(layerMatrix[i].data() + begin, (end - begin) * sizeof(double));
+                rng.normal(stream, i * cols + begin, layerMatrix[i].data() + begin, end - begin, 0.0, stddev);
+            }
+        });
     }
 
     last_layer_size = layer_size;
+
+    if (mixedPrecision) {
+        weightsBF16.emplace_back();
+        syncWorkingWeights(weightsBF16.size() - 1);
+    }
 }
 
 
+void NeuralNetwork::add_dropout(const double rate) {
+    if (weightsMatrices.empty()) {
+        throw std::invalid_argument("Dropout needs a layer to follow");
+    }
+    if (rate < 0.0 || rate >= 1.0) {
+        throw std::invalid_argument("Dropout rate must be in [0, 1)");
+    }
+    layerDropout.back() = rate;
+}
+
+void NeuralNetwork::add_gaussian_noise(const double stddev) {
+    if (weightsMatrices.empty()) {
+        throw std::invalid_argument("Noise needs a layer to follow");
+    }
+    if (stddev < 0.0) {
+        throw std::invalid_argument("Noise standard deviation must not be negative");
+    }
+    layerNoise.back() = stddev;
+}
+
+void NeuralNetwork::checkOutputRegularization() const {
+    if (!layerDropout.empty() && layerDropout.back() > 0.0) {
+        throw std::invalid_argument("Dropout needs another layer on top of it, the output layer keeps its logits");
+    }
+    if (!layerNoise.empty() && layerNoise.back() > 0.0) {
+        throw std::invalid_argument("Noise needs another layer on top of it, the output layer keeps its logits");
+    }
+}
+
 void NeuralNetwork::printStructure() {
     if (this->weightsMatrices.empty()) {
         std::cout << "Empty network" << std::endl;
@@ -48,7 +320,7 @@ void NeuralNetwork::printStructure() {
     }
     int layerNum = 1;
     for (auto& layer : weightsMatrices) {
-        std::cout << "Layer #" << layerNum << ": " << std::endl;
+        std::cout << "Layer #" << layerNum << " (" << activationName(layerActivations[layerNum-1]) << "): " << std::endl;
         for (auto nodeNum = 1 ; nodeNum <= layer.size() ; nodeNum++) {
             std::cout << "Node #" << nodeNum << "[";
             for (const auto& val : layer[nodeNum-1]) {
@@ -66,112 +338,1190 @@ void NeuralNetwork::backPropagate(const std::vector<double>& actual, const std::
     if (actual.size() != expected.size()) {
         throw std::invalid_argument("Actual size does not match expected size.");
     }
-    if (weightsMatrices.empty()) {
-        throw std::invalid_argument("Empty network");
-    }
 
     // Compute error for the output layer
     std::vector<double> outputError(actual.size());
     for (std::size_t i = 0; i < actual.size(); ++i) {
         outputError[i] = actual[i] - expected[i];
     }
+    backPropagateDelta(outputError, learning_rate);
+}
 
-    // Gradients for weights and biases
-    std::vector<std::vector<std::vector<double>>> weightGradients(weightsMatrices.size());
-    std::vector<std::vector<double>> biasGradients(biasVectors.size());
+std::size_t NeuralNetwork::parameterCount() const {
+    std::size_t count = 0;
+    for (const auto& matrix : weightsMatrices) {
+        count += matrix.size() * (matrix[0].size() + 1);
+    }
+    return count;
+}
 
-    // Backpropagation through layers
-    std::vector<double> prevLayerError = outputError;
+template <typename DeltaFn>
+void NeuralNetwork::backwardDeltas(const std::vector<double>& outputError, const bool updatesWeights,
+                                   DeltaFn&& useDeltas) {
+    if (weightsMatrices.empty()) {
+        throw std::invalid_argument("Empty network");
+    }
+
+    // Backpropagation through layers. Each layer's error lands in the parity buffer the layer above did not use.
+    const std::vector<double>* upperError = &outputError;
 
+    ThreadPool& pool = ThreadPool::instance();
     for (long long layer = static_cast<long long>(weightsMatrices.size()) - 1; layer >= 0; layer--) {
+        // A layer dropped by checkpointing, or one reading the output of such a layer, needs its segment back
+        const std::size_t index = static_cast<std::size_t>(layer);
+        if (checkpointEvery > 1 && loadedSegment != index / checkpointEvery &&
+            (!keepsActivations(index) || (index > 0 && !keepsActivations(index - 1)))) {
+            recomputeSegment(index);
+        }
         const auto& weightMatrix = weightsMatrices[layer];
-        std::vector<double> currentLayerError(weightMatrix[0].size(), 0.0);
-        std::vector<double> layerOutput = layer == 0 ? input : layerOutputs[layer - 1];
-
-        // Gradients for weights and biases
-        weightGradients[layer] = std::vector(weightMatrix.size(), std::vector(weightMatrix[0].size(), 0.0));
-        biasGradients[layer] = std::vector(biasVectors[layer].size(), 0.0);
-        #pragma omp parallel for
-        for (std::size_t neuron = 0; neuron < weightMatrix.size(); ++neuron) {
-            double gradient_clip_threshold = 5.0;
-            double delta = (layer == weightsMatrices.size() - 1)
-                               ? outputError[neuron]
-                               : prevLayerError[neuron] * UtilityFunctions::SigmoidDerivative(layerOutput[neuron]);
-
-            // Clip gradients
+        const std::size_t rows = weightMatrix.size();
+        const std::size_t cols = weightMatrix[0].size();
+        const std::vector<double>& layerOutput = layerInputOf(index);
+        const bool isOutputLayer = layer == static_cast<long long>(weightsMatrices.size()) - 1;
+
+        std::vector<double>& deltas = deltaScratch;
+        deltas.resize(rows);
+        if (isOutputLayer) {
+            std::copy(outputError.begin(), outputError.end(), deltas.begin());
+        } else {
+            // deltas = error * f'(z), specialized for this layer's activation
+            const ActivationKernels& kernels = layerKernels[layer];
+            // Only a training forward pass drew a dropout mask, after predict() the layer ran deterministically
+            const double dropout = lastForwardTraining ? layerDropout[layer] : 0.0;
+            if (storesBF16(index)) {
+                // Widened for the derivative kernels, one layer at a time
+                const std::vector<BFloat16>& storedZ = preActivationsBF16Of(index);
+                const std::vector<BFloat16>& storedY = outputsBF16Of(index);
+                widePreActivations.resize(storedZ.size());
+                wideOutputs.resize(storedY.size());
+                MixedPrecision::toDouble(storedZ.data(), widePreActivations.data(), storedZ.size());
+                MixedPrecision::toDouble(storedY.data(), wideOutputs.data(), storedY.size());
+            }
+            const std::vector<double>& z = storesBF16(index) ? widePreActivations : preActivationsOf(index);
+            const std::vector<double>& y = storesBF16(index) ? wideOutputs : outputsOf(index);
+            const std::vector<double>& error = *upperError;
+            pool.parallelFor(rows, kernels.flopsPerElement, [&](const std::size_t begin, const std::size_t end) {
+                if (dropout > 0.0) {
+                    kernels.backwardMasked(z.data() + begin, y.data() + begin,
+                                           error.data() + begin, deltas.data() + begin, end - begin,
+                                           dropoutMasks[layer].data(), begin, dropout);
+                } else {
+                    kernels.backward(z.data() + begin, y.data() + begin,
+                                     error.data() + begin, deltas.data() + begin, end - begin);
+                }
+            });
+        }
+        // Clip gradients
+        constexpr double gradient_clip_threshold = 5.0;
+        for (double& delta : deltas) {
             delta = std::max(std::min(delta, gradient_clip_threshold), -gradient_clip_threshold);
-            #pragma omp parallel for
-            for (std::size_t weight = 0; weight < weightMatrix[neuron].size(); ++weight) {
-                weightGradients[layer][neuron][weight] = delta * layerOutput[weight];
-                currentLayerError[weight] += delta * weightMatrix[neuron][weight];
+        }
+        if (!updatesWeights) {
+            useDeltas(index, deltas, layerOutput);
+        }
+
+        // Error for the next layer down: W^T * deltas, split by columns so no two tasks write the same element.
+        // It needs this layer's weights as they were in the forward pass, so a fused update waits for it.
+        std::vector<double>& currentLayerError = errorScratch[index % 2];
+        if (layer > 0) {
+            if (layerSharding[layer] != LayerSharding::Off) {
+                shardedBackpropagate(index, deltas, currentLayerError);
+            } else {
+                currentLayerError.assign(cols, 0.0);
+                pool.parallelFor(cols, 2.0 * static_cast<double>(rows), [&](const std::size_t begin, const std::size_t end) {
+                    for (std::size_t neuron = 0; neuron < rows; ++neuron) {
+                        const double delta = deltas[neuron];
+                        const std::vector<double>& row = weightMatrix[neuron];
+                        for (std::size_t weight = begin; weight < end; ++weight) {
+                            currentLayerError[weight] += delta * row[weight];
+                        }
+                    }
+                });
             }
-            biasGradients[layer][neuron] = delta;
         }
+        if (updatesWeights) {
+            useDeltas(index, deltas, layerOutput);
+        }
+        upperError = &currentLayerError; // Error for the next layer
+    }
+}
+
+void NeuralNetwork::backPropagateDelta(const std::vector<double>& outputError, const double learning_rate) {
+    // Plain SGD needs each gradient exactly once, so it is applied where it is computed instead of being
+    // written to a model-sized buffer and read back in a second pass
+    ThreadPool& pool = ThreadPool::instance();
+    backwardDeltas(outputError, true, [&](const std::size_t layer, const std::vector<double>& deltas,
+                                          const std::vector<double>& x) {
+        if (layerSharding[layer] != LayerSharding::Off) {
+            shardedFusedUpdate(layer, deltas, x, learning_rate);
+            return;
+        }
+        auto& weightMatrix = weightsMatrices[layer];
+        const std::size_t cols = weightMatrix[0].size();
+        pool.parallelFor(weightMatrix.size(), 2.0 * static_cast<double>(cols),
+            [&](const std::size_t begin, const std::size_t end) {
+                for (std::size_t neuron = begin; neuron < end; ++neuron) {
+                    const double delta = deltas[neuron];
+                    auto& row = weightMatrix[neuron];
+                    for (std::size_t weight = 0; weight < cols; ++weight) {
+                        row[weight] -= learning_rate * (delta * x[weight]);
+                    }
+                    if (mixedPrecision) {
+                        MixedPrecision::toBFloat16(row.data(), weightsBF16[layer].data() + neuron * cols, cols);
+                    }
+                    biasVectors[layer][neuron] -= learning_rate * delta;
+                }
+            });
+    });
+}
+
+void NeuralNetwork::backwardGradients(const std::vector<double>& outputError, double* gradients,
+                                      const GradientReadyFn& layerReady) {
+    if (weightsMatrices.empty()) {
+        throw std::invalid_argument("Empty network");
+    }
 
-        prevLayerError = currentLayerError; // Update error for the next layer
+    // Layer blocks of the flat gradient: row-major weight gradients, then bias gradients
+    std::vector<std::size_t> offsets(weightsMatrices.size(), 0);
+    for (std::size_t layer = 1; layer < weightsMatrices.size(); ++layer) {
+        const auto& previous = weightsMatrices[layer - 1];
+        offsets[layer] = offsets[layer - 1] + previous.size() * (previous[0].size() + 1);
     }
 
-    // Update weights and biases
+    ThreadPool& pool = ThreadPool::instance();
+    backwardDeltas(outputError, false, [&](const std::size_t layer, const std::vector<double>& deltas,
+                                           const std::vector<double>& x) {
+        const std::size_t rows = weightsMatrices[layer].size();
+        const std::size_t cols = weightsMatrices[layer][0].size();
+        double* weightGradients = gradients + offsets[layer];
+        double* biasGradients = weightGradients + rows * cols;
+        if (layerSharding[layer] != LayerSharding::Off) {
+            shardedGradients(layer, deltas, x, weightGradients);
+        } else {
+            pool.parallelFor(rows, 2.0 * static_cast<double>(cols), [&](const std::size_t begin, const std::size_t end) {
+                for (std::size_t neuron = begin; neuron < end; ++neuron) {
+                    const double delta = deltas[neuron];
+                    double* row = weightGradients + neuron * cols;
+                    for (std::size_t weight = 0; weight < cols; ++weight) {
+                        row[weight] = delta * x[weight];
+                    }
+                    biasGradients[neuron] = delta;
+                }
+            });
+        }
+        if (layerReady) {
+            layerReady(offsets[layer], offsets[layer] + rows * (cols + 1));
+        }
+    });
+}
+
+void NeuralNetwork::applyGradientStep(const double* gradients, const double learning_rate) {
+    // Update weights and biases, refreshing the bf16 working copy in the same pass
+    ThreadPool& pool = ThreadPool::instance();
     for (std::size_t layer = 0; layer < weightsMatrices.size(); ++layer) {
-        for (std::size_t neuron = 0; neuron < weightsMatrices[layer].size(); ++neuron) {
-            for (std::size_t weight = 0; weight < weightsMatrices[layer][neuron].size(); ++weight) {
-                weightsMatrices[layer][neuron][weight] -= learning_rate * weightGradients[layer][neuron][weight];
+        const std::size_t rows = weightsMatrices[layer].size();
+        const std::size_t cols = weightsMatrices[layer][0].size();
+        if (layerSharding[layer] != LayerSharding::Off) {
+            shardedUpdate(layer, gradients, learning_rate);
+            gradients += rows * (cols + 1);
+            continue;
+        }
+        const double* weightGradients = gradients;
+        const double* biasGradients = gradients + rows * cols;
+        pool.parallelFor(rows, 2.0 * static_cast<double>(cols),
+            [&](const std::size_t begin, const std::size_t end) {
+                for (std::size_t neuron = begin; neuron < end; ++neuron) {
+                    auto& row = weightsMatrices[layer][neuron];
+                    const double* rowGradients = weightGradients + neuron * cols;
+                    for (std::size_t weight = 0; weight < row.size(); ++weight) {
+                        row[weight] -= learning_rate * rowGradients[weight];
+                    }
+                    if (mixedPrecision) {
+                        MixedPrecision::toBFloat16(row.data(), weightsBF16[layer].data() + neuron * cols, cols);
+                    }
+                    biasVectors[layer][neuron] -= learning_rate * biasGradients[neuron];
+                }
+            });
+        gradients += rows * (cols + 1);
+    }
+}
+
+// Part `part` of `parts` equal contiguous parts of [0, count)
+static std::pair<std::size_t, std::size_t> evenSlice(const std::size_t count, const std::size_t part,
+                                                     const std::size_t parts) {
+    return {count * part / parts, count * (part + 1) / parts};
+}
+
+std::size_t NeuralNetwork::shardCount() const {
+    ThreadPool& pool = ThreadPool::instance();
+    const std::size_t shards = sharding.shards > 0 ? sharding.shards : pool.topology().numaNodes;
+    return std::clamp<std::size_t>(shards, 1, pool.size());
+}
+
+std::pair<std::size_t, std::size_t> NeuralNetwork::shardRange(const std::size_t count, const ShardMember& team) {
+    const auto [shardBegin, shardEnd] = evenSlice(count, team.shard, team.shards);
+    const auto [begin, end] = evenSlice(shardEnd - shardBegin, team.member, team.members);
+    return {shardBegin + begin, shardBegin + end};
+}
+
+template <typename Fn>
+void NeuralNetwork::forEachShardMember(const std::size_t shards, Fn&& fn) const {
+    ThreadPool& pool = ThreadPool::instance();
+    const std::size_t participants = pool.size();
+    // The participants of shard s are [ceil(s * P / S), ceil((s + 1) * P / S)), contiguous like the NUMA-ordered CPUs
+    const auto firstMember = [&](const std::size_t shard) { return (shard * participants + shards - 1) / shards; };
+    pool.parallelForStatic(participants, [&](const std::size_t begin, const std::size_t end) {
+        for (std::size_t participant = begin; participant < end; ++participant) {
+            ShardMember team;
+            team.shards = shards;
+            team.shard = participant * shards / participants;
+            team.member = participant - firstMember(team.shard);
+            team.members = firstMember(team.shard + 1) - firstMember(team.shard);
+            fn(team);
+        }
+    });
+}
+
+void NeuralNetwork::shardedForward(const std::size_t layer, const std::vector<double>& x, std::vector<double>& z) const {
+    const auto& weights = weightsMatrices[layer];
+    const std::size_t rows = weights.size();
+    const std::size_t cols = weights[0].size();
+    if (x.size() != cols) {
+        throw std::invalid_argument("Matrix and vector dimensions are incompatible.");
+    }
+    const std::size_t shards = shardCount();
+    z.assign(rows, 0.0);
+    if (layerSharding[layer] == LayerSharding::Rows) {
+        // Every shard writes its own rows of z, the gather is free
+        forEachShardMember(shards, [&](const ShardMember& team) {
+            const auto [begin, end] = shardRange(rows, team);
+            for (std::size_t row = begin; row < end; ++row) {
+                const std::vector<double>& w = weights[row];
+                double sum = 0.0;
+                for (std::size_t col = 0; col < cols; ++col) {
+                    sum += w[col] * x[col];
+                }
+                z[row] = sum;
+            }
+        });
+        return;
+    }
+    // Column shards: partial sums per shard over its input slice, the shard's members split the rows
+    std::vector<double> partial(shards * rows);
+    forEachShardMember(shards, [&](const ShardMember& team) {
+        const auto [colBegin, colEnd] = evenSlice(cols, team.shard, team.shards);
+        const auto [rowBegin, rowEnd] = evenSlice(rows, team.member, team.members);
+        for (std::size_t row = rowBegin; row < rowEnd; ++row) {
+            const std::vector<double>& w = weights[row];
+            double sum = 0.0;
+            for (std::size_t col = colBegin; col < colEnd; ++col) {
+                sum += w[col] * x[col];
+            }
+            partial[team.shard * rows + row] = sum;
+        }
+    });
+    // Reduce in shard order, so the result does not depend on the thread count within a shard
+    ThreadPool::instance().parallelFor(rows, static_cast<double>(shards), [&](const std::size_t begin, const std::size_t end) {
+        for (std::size_t shard = 0; shard < shards; ++shard) {
+            for (std::size_t row = begin; row < end; ++row) {
+                z[row] += partial[shard * rows + row];
+            }
+        }
+    });
+}
+
+void NeuralNetwork::shardedGradients(const std::size_t layer, const std::vector<double>& deltas,
+                                     const std::vector<double>& x, double* gradients) const {
+    const std::size_t rows = weightsMatrices[layer].size();
+    const std::size_t cols = weightsMatrices[layer][0].size();
+    double* biasGradients = gradients + rows * cols;
+    const bool byRows = layerSharding[layer] == LayerSharding::Rows;
+    // Gradients are written in the same slices the weights are owned in
+    forEachShardMember(shardCount(), [&](const ShardMember& team) {
+        const auto [begin, end] = shardRange(byRows ? rows : cols, team);
+        const std::size_t rowBegin = byRows ? begin : 0;
+        const std::size_t rowEnd = byRows ? end : rows;
+        const std::size_t colBegin = byRows ? 0 : begin;
+        const std::size_t colEnd = byRows ? cols : end;
+        for (std::size_t neuron = rowBegin; neuron < rowEnd; ++neuron) {
+            const double delta = deltas[neuron];
+            double* row = gradients + neuron * cols;
+            for (std::size_t weight = colBegin; weight < colEnd; ++weight) {
+                row[weight] = delta * x[weight];
+            }
+        }
+    });
+    std::copy(deltas.begin(), deltas.end(), biasGradients);
+}
+
+void NeuralNetwork::shardedBackpropagate(const std::size_t layer, const std::vector<double>& deltas,
+                                         std::vector<double>& lowerError) const {
+    const auto& weights = weightsMatrices[layer];
+    const std::size_t rows = weights.size();
+    const std::size_t cols = weights[0].size();
+    const std::size_t shards = shardCount();
+    lowerError.assign(cols, 0.0);
+    if (layerSharding[layer] == LayerSharding::Columns) {
+        // Each shard owns its columns of W^T * deltas outright
+        forEachShardMember(shards, [&](const ShardMember& team) {
+            const auto [begin, end] = shardRange(cols, team);
+            for (std::size_t neuron = 0; neuron < rows; ++neuron) {
+                const double delta = deltas[neuron];
+                const std::vector<double>& row = weights[neuron];
+                for (std::size_t weight = begin; weight < end; ++weight) {
+                    lowerError[weight] += delta * row[weight];
+                }
+            }
+        });
+        return;
+    }
+    // Row shards: partial products over the shard's rows, its members split the columns, then a reduction
+    std::vector<double> partial(shards * cols, 0.0);
+    forEachShardMember(shards, [&](const ShardMember& team) {
+        const auto [rowBegin, rowEnd] = evenSlice(rows, team.shard, team.shards);
+        const auto [colBegin, colEnd] = evenSlice(cols, team.member, team.members);
+        double* target = partial.data() + team.shard * cols;
+        for (std::size_t neuron = rowBegin; neuron < rowEnd; ++neuron) {
+            const double delta = deltas[neuron];
+            const std::vector<double>& row = weights[neuron];
+            for (std::size_t weight = colBegin; weight < colEnd; ++weight) {
+                target[weight] += delta * row[weight];
+            }
+        }
+    });
+    ThreadPool::instance().parallelFor(cols, static_cast<double>(shards), [&](const std::size_t begin, const std::size_t end) {
+        for (std::size_t shard = 0; shard < shards; ++shard) {
+            for (std::size_t weight = begin; weight < end; ++weight) {
+                lowerError[weight] += partial[shard * cols + weight];
             }
-            biasVectors[layer][neuron] -= learning_rate * biasGradients[layer][neuron];
         }
+    });
+}
+
+void NeuralNetwork::shardedUpdate(const std::size_t layer, const double* gradients, const double learning_rate) {
+    auto& weights = weightsMatrices[layer];
+    const std::size_t rows = weights.size();
+    const std::size_t cols = weights[0].size();
+    const bool byRows = layerSharding[layer] == LayerSharding::Rows;
+    forEachShardMember(shardCount(), [&](const ShardMember& team) {
+        const auto [begin, end] = shardRange(byRows ? rows : cols, team);
+        const std::size_t rowBegin = byRows ? begin : 0;
+        const std::size_t rowEnd = byRows ? end : rows;
+        const std::size_t colBegin = byRows ? 0 : begin;
+        const std::size_t colEnd = byRows ? cols : end;
+        for (std::size_t neuron = rowBegin; neuron < rowEnd; ++neuron) {
+            double* row = weights[neuron].data();
+            const double* rowGradients = gradients + neuron * cols;
+            for (std::size_t weight = colBegin; weight < colEnd; ++weight) {
+                row[weight] -= learning_rate * rowGradients[weight];
+            }
+            if (mixedPrecision) {
+                MixedPrecision::toBFloat16(row + colBegin, weightsBF16[layer].data() + neuron * cols + colBegin,
+                                           colEnd - colBegin);
+            }
+        }
+    });
+    const double* biasGradients = gradients + rows * cols;
+    for (std::size_t neuron = 0; neuron < rows; ++neuron) {
+        biasVectors[layer][neuron] -= learning_rate * biasGradients[neuron];
+    }
+}
+
+void NeuralNetwork::shardedFusedUpdate(const std::size_t layer, const std::vector<double>& deltas,
+                                       const std::vector<double>& x, const double learning_rate) {
+    auto& weights = weightsMatrices[layer];
+    const std::size_t rows = weights.size();
+    const std::size_t cols = weights[0].size();
+    const bool byRows = layerSharding[layer] == LayerSharding::Rows;
+    forEachShardMember(shardCount(), [&](const ShardMember& team) {
+        const auto [begin, end] = shardRange(byRows ? rows : cols, team);
+        const std::size_t rowBegin = byRows ? begin : 0;
+        const std::size_t rowEnd = byRows ? end : rows;
+        const std::size_t colBegin = byRows ? 0 : begin;
+        const std::size_t colEnd = byRows ? cols : end;
+        for (std::size_t neuron = rowBegin; neuron < rowEnd; ++neuron) {
+            const double delta = deltas[neuron];
+            double* row = weights[neuron].data();
+            for (std::size_t weight = colBegin; weight < colEnd; ++weight) {
+                row[weight] -= learning_rate * (delta * x[weight]);
+            }
+            if (mixedPrecision) {
+                MixedPrecision::toBFloat16(row + colBegin, weightsBF16[layer].data() + neuron * cols + colBegin,
+                                           colEnd - colBegin);
+            }
+        }
+    });
+    for (std::size_t neuron = 0; neuron < rows; ++neuron) {
+        biasVectors[layer][neuron] -= learning_rate * deltas[neuron];
+    }
+}
+
+double NeuralNetwork::computeGradients(const std::vector<double>& input, const std::size_t label,
+                                       std::vector<double>& gradients) {
+    this->forwardLogits(input, true);
+    const double loss = UtilityFunctions::SoftmaxCrossEntropy(this->layerPreActivations.back(), label,
+                                                              this->output, this->outputDelta);
+    // Callers may keep extra elements past the parameters, e.g. room for the loss
+    if (gradients.size() < parameterCount()) {
+        gradients.resize(parameterCount());
+    }
+    backwardGradients(this->outputDelta, gradients.data());
+    return loss;
+}
+
+void NeuralNetwork::applyGradients(const std::vector<double>& gradients) {
+    if (gradients.size() < parameterCount()) {
+        throw std::invalid_argument("Gradient size does not match the parameter count.");
+    }
+    applyGradientStep(gradients.data(), learning_rate);
+    afterTrainStep();
+}
+
+double NeuralNetwork::trainSample(const std::vector<double>& input, const std::vector<double>& expected) {
+    this->forwardLogits(input, true);
+    const double loss = UtilityFunctions::SoftmaxCrossEntropy(this->layerPreActivations.back(), expected,
+                                                              this->output, this->outputDelta);
+    this->backPropagateDelta(this->outputDelta, this->learning_rate);
+    afterTrainStep();
+    return loss;
+}
+
+double NeuralNetwork::trainSample(const std::vector<double>& input, const std::size_t label) {
+    this->forwardLogits(input, true);
+    const double loss = UtilityFunctions::SoftmaxCrossEntropy(this->layerPreActivations.back(), label,
+                                                              this->output, this->outputDelta);
+    this->backPropagateDelta(this->outputDelta, this->learning_rate);
+    afterTrainStep();
+    return loss;
+}
+
+void NeuralNetwork::afterTrainStep() {
+    trainStep++;
+    if (snapshotPublisher != nullptr && trainStep % snapshotInterval == 0) {
+        snapshotPublisher->publish(*this);
+    }
+    if (checkpointer != nullptr && trainStep % checkpointInterval == 0) {
+        checkpointer->save(*this);
+    }
+}
+
+void NeuralNetwork::setCheckpointer(Checkpointer* target, const std::size_t everySamples) {
+    if (target != nullptr && everySamples == 0) {
+        throw std::invalid_argument("Checkpoint interval must be positive.");
+    }
+    checkpointer = target;
+    checkpointInterval = everySamples;
+}
+
+void NeuralNetwork::publishSnapshots(SnapshotPublisher* publisher, const std::size_t everySamples) {
+    if (publisher != nullptr && everySamples == 0) {
+        throw std::invalid_argument("Snapshot interval must be positive.");
+    }
+    snapshotPublisher = publisher;
+    snapshotInterval = everySamples;
+    if (publisher != nullptr) {
+        publisher->publish(*this);
     }
 }
+
 void NeuralNetwork::train(const std::vector<std::vector<double>>& input, std::vector<std::vector<double>>& expected, int epochs) {
+    train(input, expected, epochs, {}, {});
+}
+
+void NeuralNetwork::train(const std::vector<std::vector<double>>& input, std::vector<std::vector<double>>& expected, int epochs,
+                          const std::vector<std::vector<double>>& validationInput,
+                          const std::vector<std::vector<double>>& validationExpected) {
+    ValidationFn validate;
+    if (!validationInput.empty()) {
+        validate = [&](const NeuralNetwork& model) { return model.evaluate(validationInput, validationExpected); };
+    }
+    std::vector<std::size_t> order;
+    trainEpochs(epochs, input.size() / EpochSampleDivisor,
+                [&](const std::uint64_t epochKey) {
+                    order = shuffledOrder(input.size(), epochKey);
+                },
+                [&](const std::size_t i) {
+                    return this->trainSample(input[order[i]], expected[order[i]]);
+                },
+                validate);
+}
+
+void NeuralNetwork::train(const Dataset& data, const int epochs, const Dataset* validation) {
+    if (!data.hasLabels()) {
+        throw std::invalid_argument("Training data has no labels.");
+    }
+    std::vector<std::size_t> order;
+    std::vector<double> features;
+    trainEpochs(epochs, data.size() / EpochSampleDivisor,
+                [&](const std::uint64_t epochKey) {
+                    order = shuffledOrder(data.size(), epochKey);
+                },
+                [&](const std::size_t i) {
+                    data.features(order[i], features);
+                    return this->trainSample(features, data.label(order[i]));
+                },
+                validationOn(validation));
+}
+
+void NeuralNetwork::train(ShardedDataset& data, const int epochs, const Dataset* validation) {
+    std::vector<double> features;
+    std::uint8_t label = 0;
+    // Same epoch length as the in-memory path, the stream is simply abandoned after it
+    trainEpochs(epochs, data.size() / EpochSampleDivisor,
+                [&](const std::uint64_t epochKey) {
+                    data.beginEpoch(rng, epochKey);
+                    // A resumed epoch replays the deterministic stream up to where the checkpoint left it
+                    for (std::size_t i = 0; i < epochPosition; ++i) {
+                        data.next(features, label);
+                    }
+                },
+                [&](std::size_t) {
+                    if (!data.next(features, label)) {
+                        throw std::runtime_error("Shard stream ended before the epoch did.");
+                    }
+                    return this->trainSample(features, label);
+                },
+                validationOn(validation));
+}
+
+void NeuralNetwork::trainReplica(const Dataset& data, const int epochs, GradientAllreduce& allreduce,
+                                 const Dataset* validation) {
+    if (!data.hasLabels()) {
+        throw std::invalid_argument("Training data has no labels.");
+    }
+    const std::size_t parameters = parameterCount();
+    if (allreduce.count() != parameters + 1) {
+        throw std::invalid_argument("Allreduce size does not match the parameter count.");
+    }
+    const std::size_t ranks = allreduce.size();
+    const std::size_t rank = allreduce.rank();
+    const std::size_t bucketElements = std::max<std::size_t>(1, allreduce.bucketElements());
+    struct ReplicaScope {
+        NeuralNetwork& network;
+        ~ReplicaScope() {
+            network.replicaCount = 1;
+            network.replicaRank = 0;
+        }
+    };
+    replicaCount = ranks;
+    replicaRank = rank;
+    const ReplicaScope scope{*this};
+    std::vector<std::size_t> order;
+    std::vector<double> features;
+    // The loss rides along in the last element, so the collectives average it with the gradients
+    std::vector<double> gradients(parameters + 1);
+    // Every replica sees the same shuffle and takes every ranks-th sample of it, one global step per
+    // ranks samples keeps the epoch length of the single-process path
+    trainEpochs(epochs, data.size() / EpochSampleDivisor / ranks,
+                [&](const std::uint64_t epochKey) {
+                    order = shuffledOrder(data.size(), epochKey);
+                },
+                [&](const std::size_t i) {
+                    const std::size_t sample = order[i * ranks + rank];
+                    data.features(sample, features);
+                    this->forwardLogits(features, true);
+                    gradients[parameters] = UtilityFunctions::SoftmaxCrossEntropy(
+                        this->layerPreActivations.back(), data.label(sample), this->output, this->outputDelta);
+                    // Layers finish from the output down, so the pending bucket grows towards the front of the
+                    // vector and is sent while the lower layers are still being differentiated
+                    std::size_t pendingBegin = parameters;
+                    std::size_t pendingEnd = parameters + 1;
+                    backwardGradients(this->outputDelta, gradients.data(),
+                                      [&](const std::size_t begin, std::size_t) {
+                                          pendingBegin = begin;
+                                          if (pendingEnd - pendingBegin >= bucketElements) {
+                                              allreduce.submit(gradients.data(), pendingBegin, pendingEnd);
+                                              pendingEnd = pendingBegin;
+                                          }
+                                      });
+                    if (pendingEnd > pendingBegin) {
+                        allreduce.submit(gradients.data(), pendingBegin, pendingEnd);
+                    }
+                    allreduce.wait();
+                    applyGradients(gradients);
+                    return gradients[parameters] * static_cast<double>(ranks);
+                },
+                validationOn(rank == 0 ? validation : nullptr));
+}
+
+std::vector<std::size_t> NeuralNetwork::shuffledOrder(const std::size_t sampleCount, const std::uint64_t epochKey) const {
+    std::vector<std::size_t> order(sampleCount);
+    std::iota(order.begin(), order.end(), 0);
+    rng.shuffle(Philox::stream(Philox::Shuffle, epochKey), order);
+    return order;
+}
+
+NeuralNetwork::ValidationFn NeuralNetwork::validationOn(const Dataset* validation) {
+    if (validation == nullptr || validation->empty()) {
+        return {};
+    }
+    return [validation](const NeuralNetwork& model) { return model.evaluate(*validation); };
+}
+
+template <typename BeginFn, typename StepFn>
+void NeuralNetwork::trainEpochs(const int epochs, const std::size_t samplesPerEpoch, BeginFn&& beginEpoch,
+                                StepFn&& step, const ValidationFn& validate) {
+    // Validation of the previous epoch, reported once the next one has trained
+    Async::Task<EvaluationResult> pendingValidation;
+    std::size_t validatedEpoch = 0;
+    const auto reportValidation = [&] {
+        if (!pendingValidation.valid()) {
+            return;
+        }
+        const EvaluationResult result = pendingValidation.get();
+        pendingValidation = {};
+        std::cout << "Epoch #" << validatedEpoch << " validation loss: " << result.loss
+                  << " accuracy: " << result.accuracy
+                  << " top-5 accuracy: " << result.topKAccuracy << std::endl;
+    };
+
     total_error = 0;
     for (std::size_t epoch = 0; epoch < epochs; epoch++) {
         std::cout << "Epoch: " << epoch << std::endl;
-        std::vector<double> EpochError;
-        #pragma omp parallel for
-        for (int i = 0; i < input.size() / 100; i++){
-            this->forwardPass(input[i]);
-            this->backPropagate(this->output, expected[i], 0.1);
-            auto error = UtilityFunctions::MSE(this->output, expected[i]);
-            EpochError.push_back(std::reduce(error.begin(), error.end(), 0.0));
-        }
-        double epochTotalError = std::reduce(EpochError.begin(), EpochError.end(), 0.0);
+        // epochCounter keys the epoch's shuffle; after a restored checkpoint the first epoch picks up
+        // at epochPosition instead of starting over
+        beginEpoch(epochCounter);
+        double epochTotalError = 0.0;
+        while (epochPosition < samplesPerEpoch) {
+            // Counted before the step, so a checkpoint taken inside it already includes this sample
+            const std::size_t i = epochPosition++;
+            epochTotalError += step(i);
+        }
+        epochCounter++;
+        epochPosition = 0;
         std::cout << "Epoch #" << epoch << " error: " << epochTotalError << std::endl;
-    }
+        total_error = epochTotalError;
 
-    #pragma omp parallel for reduction(+:total_error)
-    for (const auto & i : expected) {
-        auto error = UtilityFunctions::MSE(this->output, i);
-        const double partial_error = std::reduce(std::execution::seq, error.begin(), error.end(), 0.0);
-        total_error += partial_error;
+        reportValidation();
+        if (validate) {
+            // The copy is taken between steps, so the task never sees weights being updated
+            auto snapshot = std::make_shared<const NeuralNetwork>(*this);
+            pendingValidation = Async::spawn([snapshot, &validate] { return validate(*snapshot); });
+            validatedEpoch = epoch;
+        }
     }
+    reportValidation();
     std::cout << "Final total error: " << total_error << std::endl;
 }
 
+void NeuralNetwork::trainEpochsWith(const int epochs, const std::size_t samplesPerEpoch,
+                                    const std::function<void(std::uint64_t)>& beginEpoch,
+                                    const std::function<double(std::size_t)>& step,
+                                    const ValidationFn& validate) {
+    trainEpochs(epochs, samplesPerEpoch, beginEpoch, step, validate);
+}
+
+const std::vector<double>& NeuralNetwork::inferLogits(const std::vector<double>& input, InferenceScratch& scratch) const {
+    if (weightsMatrices.empty()) {
+        throw std::invalid_argument("Empty network");
+    }
+    std::vector<double>& z = scratch.preActivations;
+    for (std::size_t i = 0; i < weightsMatrices.size(); ++i) {
+        // The first layer reads the caller's input in place
+        const std::vector<double>& x = i == 0 ? input : scratch.layerInput;
+        if (layerSharding[i] != LayerSharding::Off) {
+            shardedForward(i, x, z);
+            UtilityFunctions::AddInPlace(z, biasVectors[i]);
+        } else if (mixedPrecision) {
+            scratch.activationBF16.resize(x.size());
+            MixedPrecision::toBFloat16(x.data(), scratch.activationBF16.data(), x.size());
+            z.assign(weightsMatrices[i].size(), 0.0);
+            MixedPrecision::multiplyMatrixVector(weightsBF16[i], scratch.activationBF16, z);
+            UtilityFunctions::AddInPlace(z, biasVectors[i]);
+        } else if (kernelAutotuning) {
+            KernelTuner::multiplyAdd(weightsMatrices[i], x, biasVectors[i], z, layerMatVec[i]);
+        } else {
+            Expr::assign(z, Expr::matrix(weightsMatrices[i]) * x + biasVectors[i]);
+        }
+        if (i != weightsMatrices.size() - 1) {
+            applyActivation(i, z, scratch.layerInput);
+        }
+    }
+    return z;
+}
+
+EvaluationResult NeuralNetwork::evaluate(const std::vector<std::vector<double>>& input,
+                                         const std::vector<std::vector<double>>& expected,
+                                         const std::size_t topK) const {
+    if (input.size() != expected.size()) {
+        throw std::invalid_argument("Input count does not match expected count.");
+    }
+    const std::size_t classes = weightsMatrices.empty() ? 0 : weightsMatrices.back().size();
+    for (const auto& target : expected) {
+        if (target.size() != classes) {
+            throw std::invalid_argument("Expected size does not match output size.");
+        }
+    }
+    return evaluateSamples(input.size(), classes, topK, [&](const std::size_t sample, SampleView& view) {
+        view.input = &input[sample];
+        view.target = &expected[sample];
+    });
+}
+
+EvaluationResult NeuralNetwork::evaluate(const Dataset& data, const std::size_t topK) const {
+    const std::size_t classes = weightsMatrices.empty() ? 0 : weightsMatrices.back().size();
+    if (!data.hasLabels() || data.classCount() != classes) {
+        throw std::invalid_argument("Dataset labels do not match the output size.");
+    }
+    return evaluateSamples(data.size(), classes, topK, [&](const std::size_t sample, SampleView& view) {
+        data.features(sample, view.inputBuffer);
+        view.targetBuffer.assign(classes, 0.0);
+        view.targetBuffer[data.label(sample)] = 1.0;
+        view.input = &view.inputBuffer;
+        view.target = &view.targetBuffer;
+    });
+}
+
+template <typename SampleFn>
+EvaluationResult NeuralNetwork::evaluateSamples(const std::size_t count, const std::size_t classes, const std::size_t topK,
+                                                SampleFn&& loadSample) const {
+    struct Accumulator {
+        std::size_t samples = 0;
+        double loss = 0.0;
+        std::size_t correct = 0;
+        std::size_t topKCorrect = 0;
+        std::vector<std::vector<std::size_t>> confusion;
+    };
+
+    EvaluationResult result;
+    result.confusionMatrix.assign(classes, std::vector<std::size_t>(classes, 0));
+    std::size_t correct = 0;
+    std::size_t topKCorrect = 0;
+    std::mutex mergeMutex;
+
+    // Every task fills a private accumulator and merges it once at the end of its range
+    double flopsPerSample = 0.0;
+    for (const auto& matrix : weightsMatrices) {
+        flopsPerSample += 2.0 * static_cast<double>(matrix.size() * matrix[0].size());
+    }
+    ThreadPool::instance().parallelFor(count, flopsPerSample, [&](const std::size_t begin, const std::size_t end) {
+        Accumulator acc;
+        acc.confusion.assign(classes, std::vector<std::size_t>(classes, 0));
+        InferenceScratch scratch;
+        SampleView view;
+        for (std::size_t sample = begin; sample < end; ++sample) {
+            loadSample(sample, view);
+            const std::vector<double>& logits = inferLogits(*view.input, scratch);
+            const std::vector<double>& target = *view.target;
+
+            // Loss straight from the logits: -sum(y * (z - logsumexp(z)))
+            const double maxLogit = *std::ranges::max_element(logits);
+            double sum = 0.0;
+            for (const double z : logits) {
+                sum += ActivationMath::exp(z - maxLogit);
+            }
+            const double logSum = maxLogit + std::log(sum);
+            for (std::size_t i = 0; i < classes; ++i) {
+                acc.loss -= target[i] * (logits[i] - logSum);
+            }
+
+            const auto label = static_cast<std::size_t>(std::distance(target.begin(), std::ranges::max_element(target)));
+            const auto predicted = static_cast<std::size_t>(std::distance(logits.begin(), std::ranges::max_element(logits)));
+            // Rank of the true class = number of strictly larger logits, no sort needed
+            const auto rank = static_cast<std::size_t>(std::ranges::count_if(logits, [&](const double z) {
+                return z > logits[label];
+            }));
+            acc.correct += predicted == label;
+            acc.topKCorrect += rank < topK;
+            acc.confusion[label][predicted]++;
+            acc.samples++;
+        }
+
+        std::lock_guard lock(mergeMutex);
+        result.samples += acc.samples;
+        result.loss += acc.loss;
+        correct += acc.correct;
+        topKCorrect += acc.topKCorrect;
+        for (std::size_t i = 0; i < classes; ++i) {
+            for (std::size_t j = 0; j < classes; ++j) {
+                result.confusionMatrix[i][j] += acc.confusion[i][j];
+            }
+        }
+    });
+
+    if (result.samples > 0) {
+        const auto count = static_cast<double>(result.samples);
+        result.loss /= count;
+        result.accuracy = static_cast<double>(correct) / count;
+        result.topKAccuracy = static_cast<double>(topKCorrect) / count;
+    }
+    return result;
+}
+
+std::size_t NeuralNetwork::trainOnline(SampleStream& stream, const OnlineTrainingConfig& config) {
+    if (weightsMatrices.empty() || stream.featureCount() != inputSize() ||
+        stream.classCount() != weightsMatrices.back().size()) {
+        throw std::invalid_argument("Stream shape does not match the network.");
+    }
+    // One batch trains while the reader thread fills the other, memory stays at 2 * batchSize rows
+    BatchReader reader(stream, config.batchSize);
+    std::vector<double> features;
+    std::size_t samples = 0;
+    std::size_t sinceSnapshot = 0;
+    double snapshotLoss = 0.0;
+    const auto publish = [&] {
+        std::cout << "Online: " << samples << " samples, mean loss "
+                  << (sinceSnapshot > 0 ? snapshotLoss / static_cast<double>(sinceSnapshot) : 0.0) << std::endl;
+        if (!config.snapshotPath.empty()) {
+            save(config.snapshotPath);
+        }
+        sinceSnapshot = 0;
+        snapshotLoss = 0.0;
+    };
+
+    while (const Dataset* batch = reader.next()) {
+        const std::size_t count = batch->size();
+        for (std::size_t i = 0; i < count; ++i) {
+            batch->features(i, features);
+            snapshotLoss += this->trainSample(features, batch->label(i));
+        }
+        samples += count;
+        sinceSnapshot += count;
+        if (config.snapshotEvery > 0 && sinceSnapshot >= config.snapshotEvery) {
+            publish();
+        }
+    }
+    publish();
+    return samples;
+}
+
 std::vector<double> NeuralNetwork::predict(const std::vector<double>& input) {
     this->forwardPass(input);
     return this->output;
 }
 
+std::vector<double> NeuralNetwork::infer(const std::vector<double>& input) const {
+    thread_local InferenceScratch scratch;
+    return UtilityFunctions::Softmax(inferLogits(input, scratch));
+}
+
 void NeuralNetwork::addWeightLayer(const std::vector<std::vector<double>>& weights) {
     // construct element in place and push it to weights vector
     auto& layer = weightsMatrices.back();
     auto& layerBiases = biasVectors.back();
     layer = weights;
     layerBiases = std::vector<double>(last_layer_size, 0.0);
+    if (mixedPrecision) {
+        syncWorkingWeights(weightsMatrices.size() - 1);
+    }
 }
 
 void NeuralNetwork::forwardPass(const std::vector<double>& input) {
+    this->forwardLogits(input);
+    this->output = UtilityFunctions::Softmax(this->layerPreActivations.back()); // Apply Softmax for output layer
+}
+
+void NeuralNetwork::forwardLogits(const std::vector<double>& input, const bool training) {
+    if (weightsMatrices.empty()) {
+        throw std::invalid_argument("Empty network");
+    }
+    if (training) {
+        checkOutputRegularization();
+    }
     this->input = input;
-    this->layerOutputs.clear();
-    auto prev = input;
-    for (int i = 0; i < weightsMatrices.size(); ++i) {
-        prev = UtilityFunctions::multiplyMatrixVector(weightsMatrices[i], prev);
-        prev = UtilityFunctions::VectorAddition(prev, biasVectors[i]);
-        if (i == weightsMatrices.size() - 1) {
-            prev = UtilityFunctions::Softmax(prev); // Apply Softmax for output layer
+    this->lastForwardTraining = training;
+    this->layerPreActivations.resize(weightsMatrices.size());
+    this->layerOutputs.resize(weightsMatrices.size());
+    if (mixedPrecision) {
+        this->layerPreActivationsBF16.resize(weightsMatrices.size());
+        this->layerOutputsBF16.resize(weightsMatrices.size());
+    }
+    for (std::size_t i = 0; i < weightsMatrices.size(); ++i) {
+        forwardLayer(i, training);
+        if (!keepsActivations(i)) {
+            loadedSegment = i / checkpointEvery;
+        }
+    }
+}
+
+bool NeuralNetwork::keepsActivations(const std::size_t layer) const {
+    return checkpointEvery <= 1 || (layer + 1) % checkpointEvery == 0 || layer + 1 == weightsMatrices.size();
+}
+
+std::vector<double>& NeuralNetwork::preActivationsOf(const std::size_t layer) {
+    return keepsActivations(layer) ? layerPreActivations[layer] : segmentPreActivations[layer % checkpointEvery];
+}
+
+std::vector<double>& NeuralNetwork::outputsOf(const std::size_t layer) {
+    return keepsActivations(layer) ? layerOutputs[layer] : segmentOutputs[layer % checkpointEvery];
+}
+
+bool NeuralNetwork::storesBF16(const std::size_t layer) const {
+    return mixedPrecision && layer + 1 < weightsMatrices.size();
+}
+
+std::vector<BFloat16>& NeuralNetwork::preActivationsBF16Of(const std::size_t layer) {
+    return keepsActivations(layer) ? layerPreActivationsBF16[layer] : segmentPreActivationsBF16[layer % checkpointEvery];
+}
+
+std::vector<BFloat16>& NeuralNetwork::outputsBF16Of(const std::size_t layer) {
+    return keepsActivations(layer) ? layerOutputsBF16[layer] : segmentOutputsBF16[layer % checkpointEvery];
+}
+
+const std::vector<double>& NeuralNetwork::layerInputOf(const std::size_t layer) {
+    if (layer == 0) {
+        return input;
+    }
+    if (!storesBF16(layer - 1)) {
+        return outputsOf(layer - 1);
+    }
+    const std::vector<BFloat16>& stored = outputsBF16Of(layer - 1);
+    wideInput.resize(stored.size());
+    MixedPrecision::toDouble(stored.data(), wideInput.data(), stored.size());
+    return wideInput;
+}
+
+void NeuralNetwork::recomputeSegment(const std::size_t layer) {
+    // Starts from the kept output of the segment below, or the input. trainStep has not moved since the
+    // forward pass, so the stochastic layers draw the same noise and dropout masks again.
+    const std::size_t segment = layer / checkpointEvery;
+    const std::size_t first = segment * checkpointEvery;
+    const std::size_t end = std::min(first + checkpointEvery, weightsMatrices.size());
+    for (std::size_t i = first; i < end; ++i) {
+        if (!keepsActivations(i)) {
+            forwardLayer(i, lastForwardTraining);
+        }
+    }
+    loadedSegment = segment;
+}
+
+void NeuralNetwork::forwardLayer(const std::size_t i, const bool training) {
+    // A layer storing bf16 computes in fp64 in the wide buffers and keeps only the narrowed copies
+    const bool narrows = storesBF16(i);
+    std::vector<double>& z = narrows ? widePreActivations : preActivationsOf(i);
+    if (layerSharding[i] != LayerSharding::Off) {
+        shardedForward(i, layerInputOf(i), z);
+        UtilityFunctions::AddInPlace(z, biasVectors[i]);
+    } else if (mixedPrecision) {
+        // bf16 activations against the bf16 working weights, accumulated in fp32. The layer below stored its
+        // output in bf16 already, only the network input is converted.
+        const std::vector<BFloat16>* x = &activationBF16;
+        if (i > 0) {
+            x = &outputsBF16Of(i - 1);
         } else {
-            prev = UtilityFunctions::SigmoidVector(prev);
+            activationBF16.resize(input.size());
+            MixedPrecision::toBFloat16(input.data(), activationBF16.data(), input.size());
+        }
+        z.assign(weightsMatrices[i].size(), 0.0);
+        MixedPrecision::multiplyMatrixVector(weightsBF16[i], *x, z);
+        UtilityFunctions::AddInPlace(z, biasVectors[i]);
+    } else if (kernelAutotuning) {
+        KernelTuner::multiplyAdd(weightsMatrices[i], layerInputOf(i), biasVectors[i], z, layerMatVec[i]);
+    } else {
+        // W x + b in one pass, the product never materializes
+        Expr::assign(z, Expr::matrix(weightsMatrices[i]) * layerInputOf(i) + biasVectors[i]);
+    }
+    // The output layer keeps only its logits, softmax is applied by the caller, plain or fused with the loss
+    if (i == weightsMatrices.size() - 1) {
+        return;
+    }
+    std::vector<double>& y = narrows ? wideOutputs : outputsOf(i);
+    if (training && (layerDropout[i] > 0.0 || layerNoise[i] > 0.0)) {
+        applyStochasticActivation(i, z, y);
+    } else {
+        applyActivation(i, z, y);
+    }
+    if (narrows) {
+        std::vector<BFloat16>& storedZ = preActivationsBF16Of(i);
+        std::vector<BFloat16>& storedY = outputsBF16Of(i);
+        storedZ.resize(z.size());
+        storedY.resize(y.size());
+        MixedPrecision::toBFloat16(z.data(), storedZ.data(), z.size());
+        MixedPrecision::toBFloat16(y.data(), storedY.data(), y.size());
+    }
+}
+
+void NeuralNetwork::applyActivation(const std::size_t layer, const std::vector<double>& z, std::vector<double>& y) const {
+    y.resize(z.size());
+    const ActivationKernels& kernels = layerKernels[layer];
+    ThreadPool::instance().parallelFor(z.size(), kernels.flopsPerElement, [&](const std::size_t begin, const std::size_t end) {
+        kernels.forward(z.data() + begin, y.data() + begin, end - begin);
+    });
+}
+
+void NeuralNetwork::applyStochasticActivation(const std::size_t layer, std::vector<double>& z, std::vector<double>& y) {
+    y.resize(z.size());
+    dropoutMasks[layer].resize((z.size() + MaskTile - 1) / MaskTile);
+
+    StochasticContext context;
+    context.rng = &rng;
+    // One stream per sample of the global step, a single process is its only replica
+    const std::uint64_t sample = trainStep * replicaCount + replicaRank;
+    context.noiseStream = Philox::stream(Philox::Noise, (sample << 16) | layer);
+    context.dropoutStream = Philox::stream(Philox::Dropout, (sample << 16) | layer);
+    context.noiseStddev = layerNoise[layer];
+    context.dropoutRate = layerDropout[layer];
+    context.mask = dropoutMasks[layer].data();
+
+    // Parallel over whole mask words so no two tasks write the same word
+    const ActivationKernels& kernels = layerKernels[layer];
+    const std::size_t tiles = dropoutMasks[layer].size();
+    ThreadPool::instance().parallelFor(tiles, (kernels.flopsPerElement + 40.0) * MaskTile,
+        [&](const std::size_t begin, const std::size_t end) {
+            StochasticContext tileContext = context;
+            tileContext.firstElement = begin * MaskTile;
+            const std::size_t last = std::min(end * MaskTile, z.size());
+            kernels.forwardStochastic(z.data() + tileContext.firstElement, y.data() + tileContext.firstElement,
+                                      last - tileContext.firstElement, tileContext);
+        });
+}
+
+std::size_t NeuralNetwork::inputSize() const {
+    return weightsMatrices.empty() ? last_layer_size : weightsMatrices[0][0].size();
+}
+
+// Model file: magic, input size, layer count, then per layer rows, cols, activation,
+// row-major weights and biases. Sizes are uint64, values are native doubles.
+static constexpr char ModelMagic[8] = {'N', 'N', 'M', 'O', 'D', 'E', 'L', '1'};
+// Checkpoint: magic, a model section, then learning rate, seed, train step, epoch, position in the epoch,
+// mixed precision flag and per layer dropout rate and noise stddev
+static constexpr char CheckpointMagic[8] = {'N', 'N', 'C', 'K', 'P', 'T', '0', '1'};
+
+template <typename T>
+static void appendValues(std::vector<char>& out, const T* values, const std::size_t count) {
+    const auto* bytes = reinterpret_cast<const char*>(values);
+    out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+// Sequential reads from a serialized buffer, with bounds checks
+struct ByteReader {
+    const std::vector<char>& data;
+    const std::string& source;
+    std::size_t offset = 0;
+
+    template <typename T>
+    void read(T* values, const std::size_t count) {
+        const std::size_t bytes = count * sizeof(T);
+        if (data.size() - offset < bytes) {
+            throw std::runtime_error("File is truncated: " + source);
+        }
+        std::memcpy(values, data.data() + offset, bytes);
+        offset += bytes;
+    }
+
+    template <typename T>
+    T read() {
+        T value;
+        read(&value, 1);
+        return value;
+    }
+
+    void expectMagic(const char (&magic)[8]) {
+        char found[8];
+        read(found, 8);
+        if (std::memcmp(found, magic, 8) != 0) {
+            throw std::runtime_error("Unexpected file format: " + source);
+        }
+    }
+};
+
+void NeuralNetwork::appendModel(std::vector<char>& out) const {
+    appendValues(out, ModelMagic, sizeof(ModelMagic));
+    const std::uint64_t header[2] = {inputSize(), weightsMatrices.size()};
+    appendValues(out, header, 2);
+    for (std::size_t layer = 0; layer < weightsMatrices.size(); ++layer) {
+        const auto& matrix = weightsMatrices[layer];
+        const std::uint64_t shape[3] = {matrix.size(), matrix[0].size(),
+                                        static_cast<std::uint64_t>(layerActivations[layer])};
+        appendValues(out, shape, 3);
+        for (const auto& row : matrix) {
+            appendValues(out, row.data(), row.size());
+        }
+        appendValues(out, biasVectors[layer].data(), biasVectors[layer].size());
+    }
+}
+
+NeuralNetwork NeuralNetwork::readModel(ByteReader& reader) {
+    reader.expectMagic(ModelMagic);
+    std::uint64_t header[2];
+    reader.read(header, 2);
+    NeuralNetwork network(header[0]);
+    for (std::uint64_t layer = 0; layer < header[1]; ++layer) {
+        std::uint64_t shape[3];
+        reader.read(shape, 3);
+        if (shape[1] != network.last_layer_size || shape[2] > static_cast<std::uint64_t>(ActivationType::Identity)) {
+            throw std::runtime_error("Inconsistent layer shape in " + reader.source);
+        }
+        network.add_layer(shape[0], static_cast<ActivationType>(shape[2]));
+        for (auto& row : network.weightsMatrices.back()) {
+            reader.read(row.data(), row.size());
         }
-        layerOutputs.push_back(prev);
+        reader.read(network.biasVectors.back().data(), network.biasVectors.back().size());
     }
-    this->output = prev;
-}
\ No newline at end of file
+    return network;
+}
+
+void NeuralNetwork::save(const std::string& path) const {
+    std::vector<char> contents;
+    appendModel(contents);
+    UtilityFunctions::writeFileAtomic(path, contents.data(), contents.size());
+}
+
+NeuralNetwork NeuralNetwork::load(const std::string& path) {
+    const std::vector<char> contents = UtilityFunctions::readFile(path);
+    ByteReader reader{contents, path};
+    return readModel(reader);
+}
+
+void NeuralNetwork::checkpointState(std::vector<char>& out) const {
+    out.clear();
+    appendValues(out, CheckpointMagic, sizeof(CheckpointMagic));
+    appendModel(out);
+    const double rate = learning_rate;
+    const std::uint64_t position[5] = {rng.getSeed(), trainStep, epochCounter, epochPosition, mixedPrecision};
+    appendValues(out, &rate, 1);
+    appendValues(out, position, 5);
+    appendValues(out, layerDropout.data(), layerDropout.size());
+    appendValues(out, layerNoise.data(), layerNoise.size());
+}
+
+NeuralNetwork NeuralNetwork::restoreCheckpoint(const std::vector<char>& state, const std::string& source) {
+    ByteReader reader{state, source};
+    reader.expectMagic(CheckpointMagic);
+    NeuralNetwork network = readModel(reader);
+    network.learning_rate = reader.read<double>();
+    std::uint64_t position[5];
+    reader.read(position, 5);
+    network.rng = Philox(position[0]);
+    network.trainStep = position[1];
+    network.epochCounter = position[2];
+    network.epochPosition = position[3];
+    reader.read(network.layerDropout.data(), network.layerDropout.size());
+    reader.read(network.layerNoise.data(), network.layerNoise.size());
+    network.setMixedPrecision(position[4] != 0);
+    return network;
+}
+
+NeuralNetwork NeuralNetwork::restoreCheckpoint(const std::string& path) {
+    return restoreCheckpoint(UtilityFunctions::readFile(path), path);
+}
+
+void NeuralNetwork::loadCheckpointState(const std::vector<char>& state, const std::string& source) {
+    const NeuralNetwork restored = restoreCheckpoint(state, source);
+    if (restored.inputSize() != inputSize() || restored.weightsMatrices.size() != weightsMatrices.size()) {
+        throw std::runtime_error("Checkpoint does not match the network: " + source);
+    }
+    for (std::size_t layer = 0; layer < weightsMatrices.size(); ++layer) {
+        if (restored.weightsMatrices[layer].size() != weightsMatrices[layer].size() ||
+            restored.layerActivations[layer] != layerActivations[layer]) {
+            throw std::runtime_error("Checkpoint does not match the network: " + source);
+        }
+    }
+    // Copied into the existing rows, so they stay on the NUMA node of the threads that first touched them
+    for (std::size_t layer = 0; layer < weightsMatrices.size(); ++layer) {
+        for (std::size_t row = 0; row < weightsMatrices[layer].size(); ++row) {
+            std::ranges::copy(restored.weightsMatrices[layer][row], weightsMatrices[layer][row].begin());
+        }
+        biasVectors[layer] = restored.biasVectors[layer];
+        if (mixedPrecision) {
+            syncWorkingWeights(layer);
+        }
+    }
+    learning_rate = restored.learning_rate;
+    rng = restored.rng;
+    trainStep = restored.trainStep;
+    epochCounter = restored.epochCounter;
+    epochPosition = restored.epochPosition;
+    layerDropout = restored.layerDropout;
+    layerNoise = restored.layerNoise;
+}
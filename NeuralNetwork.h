@@ -1,38 +1,326 @@
 #ifndef NEURALNETWORK_H
 #define NEURALNETWORK_H
 
+#include <array>
+#include <functional>
 #include <vector>
 #include <random>
 
+#include "Activation.h"
+#include "BFloat16.h"
+#include "Dataset.h"
+#include "KernelTuner.h"
+#include "MemoryPlan.h"
+#include "Philox.h"
+#include "SampleStream.h"
+#include "ShardedDataset.h"
+
+struct EvaluationResult {
+    std::size_t samples = 0;
+    double loss = 0.0;         // mean cross-entropy
+    double accuracy = 0.0;
+    double topKAccuracy = 0.0; // true class among the k largest outputs
+    std::vector<std::vector<std::size_t>> confusionMatrix; // [expected class][predicted class]
+};
+
+class Checkpointer;
+class SnapshotPublisher;
+class GradientAllreduce;
+struct ByteReader;
+
+struct OnlineTrainingConfig {
+    std::size_t batchSize = 32;        // samples pulled from the stream per round, the next batch is read meanwhile
+    std::size_t snapshotEvery = 10000; // samples between published snapshots, 0 publishes only at the end
+    std::string snapshotPath;          // empty: no snapshots
+};
+
+// Intra-layer model parallelism for layers too wide for any cache. A sharded layer's weights are split into
+// one shard per NUMA node, by rows (each shard produces its slice of the output, gathered in place) or by
+// columns (each shard sums over its slice of the input, the partial outputs are reduced). The pool threads
+// of a node split its shard further and first-touch their part of it, so with NN_PIN_THREADS every byte of
+// a wide layer is read by a core on the node that holds it.
+enum class LayerSharding {
+    Off,
+    Rows,
+    Columns,
+    Auto // rows for layers with more outputs than inputs, columns otherwise
+};
+
+struct ShardingConfig {
+    LayerSharding mode = LayerSharding::Auto;
+    std::size_t thresholdBytes = std::size_t{64} << 20; // layers with smaller weight matrices are not sharded
+    std::size_t shards = 0;                              // 0: one per NUMA node
+};
+
 class NeuralNetwork {
+    friend class SharedModel; // exports the weights into a flat shared image
+    friend class Pipeline;    // runs the layers stage by stage on its own threads
+
 private:
     std::vector<std::vector<std::vector<double>>> weightsMatrices;
     std::vector<std::vector<double>> biasVectors;
+    std::vector<std::vector<double>> layerPreActivations; // W*x + b per layer, the last one holds the logits
     std::vector<std::vector<double>> layerOutputs;
+    // Activation checkpointing: only every k-th layer (and the output layer) keeps z and y in the vectors above.
+    // The others of a segment share slot i % k of these buffers and are recomputed from the segment's input
+    // during the backward pass, one segment at a time.
+    std::size_t checkpointEvery = 1;
+    std::vector<std::vector<double>> segmentPreActivations;
+    std::vector<std::vector<double>> segmentOutputs;
+    std::size_t loadedSegment = 0;     // segment whose recomputable layers the buffers hold
+    bool lastForwardTraining = false;  // whether the forward pass being differentiated was stochastic
+    std::vector<ActivationType> layerActivations;
+    std::vector<ActivationKernels> layerKernels;          // resolved once in add_layer
+    std::vector<double> layerDropout;                     // training-only regularization per layer, 0 = off
+    std::vector<double> layerNoise;
+    ShardingConfig sharding;
+    std::vector<LayerSharding> layerSharding; // Off, Rows or Columns per layer, decided in add_layer
+    bool kernelAutotuning = false;
+    std::vector<MatVecConfig> layerMatVec;    // tuned fp64 W * x + b kernel per layer, used with autotuning
+    std::vector<std::vector<std::uint64_t>> dropoutMasks; // packed keep bits of the last training forward
+    std::uint64_t trainStep = 0;                          // samples trained so far, keys the dropout/noise streams
+    // Set by trainReplica: replicas share trainStep, the rank keeps their dropout/noise streams apart
+    std::uint64_t replicaCount = 1;
+    std::uint64_t replicaRank = 0;
     std::vector<double> output;
+    std::vector<double> outputDelta; // d(loss)/d(logits) of the last trained sample
     std::vector<double> input;
-    std::mt19937 gen;
+    Philox rng;
+    std::uint64_t epochCounter = 0;  // epochs trained so far, keys the shuffle stream of the epoch in progress
+    std::uint64_t epochPosition = 0; // samples of that epoch already trained
     double learning_rate = 0.01;
     unsigned long long last_layer_size;
     double total_error;
 
+    // Mixed precision: bf16 working copy of weightsMatrices (row-major per layer), the doubles stay the master copy
+    bool mixedPrecision = false;
+    std::vector<std::vector<BFloat16>> weightsBF16;
+    std::vector<BFloat16> activationBF16;
+    // and the hidden layers keep z and y in bf16, split into kept and segment buffers like the doubles above.
+    // The next layer reads y as it is, the backward pass widens one layer at a time into the wide buffers.
+    std::vector<std::vector<BFloat16>> layerPreActivationsBF16;
+    std::vector<std::vector<BFloat16>> layerOutputsBF16;
+    std::vector<std::vector<BFloat16>> segmentPreActivationsBF16;
+    std::vector<std::vector<BFloat16>> segmentOutputsBF16;
+    std::vector<double> widePreActivations;
+    std::vector<double> wideOutputs;
+    std::vector<double> wideInput;
+
+    SnapshotPublisher* snapshotPublisher = nullptr;
+    std::size_t snapshotInterval = 0; // trained samples between published snapshots
+    Checkpointer* checkpointer = nullptr;
+    std::size_t checkpointInterval = 0;
+
+    void afterTrainStep();
+    // Throws when the output layer still carries dropout or noise, which its logits never apply
+    void checkOutputRegularization() const;
+
+    void syncWorkingWeights(std::size_t layer);
+    // Drops every stored activation, after the checkpoint interval or the precision changed
+    void resetActivationStorage();
+
+    void forwardLogits(const std::vector<double>& input, bool training = false);
+    // z and y of one layer from the output of the layer below, written wherever that layer's activations live
+    void forwardLayer(std::size_t layer, bool training);
+    [[nodiscard]] bool keepsActivations(std::size_t layer) const;
+    std::vector<double>& preActivationsOf(std::size_t layer);
+    std::vector<double>& outputsOf(std::size_t layer);
+    // Hidden layers with mixed precision store their activations in bf16
+    [[nodiscard]] bool storesBF16(std::size_t layer) const;
+    std::vector<BFloat16>& preActivationsBF16Of(std::size_t layer);
+    std::vector<BFloat16>& outputsBF16Of(std::size_t layer);
+    // The layer's input in fp64: the network input, or the output of the layer below, widened if stored in bf16
+    const std::vector<double>& layerInputOf(std::size_t layer);
+    // Replays the forward pass of the recomputable layers of segment (layer / k), with the same dropout and noise
+    void recomputeSegment(std::size_t layer);
+
+    // Wide-layer kernels. Pool participant p works for shard p * shards / participants, on its own
+    // contiguous part of the shard, so every pass touches the same pages from the same threads.
+    struct ShardMember {
+        std::size_t shard = 0;
+        std::size_t shards = 1;
+        std::size_t member = 0;  // index among the shard's participants
+        std::size_t members = 1;
+    };
+    [[nodiscard]] std::size_t shardCount() const;
+    // The member's part of its shard's part of [0, count)
+    static std::pair<std::size_t, std::size_t> shardRange(std::size_t count, const ShardMember& team);
+    template <typename Fn>
+    void forEachShardMember(std::size_t shards, Fn&& fn) const;
+    void shardedForward(std::size_t layer, const std::vector<double>& x, std::vector<double>& z) const;
+    // Weight and bias gradients of a sharded layer from its clipped deltas
+    void shardedGradients(std::size_t layer, const std::vector<double>& deltas, const std::vector<double>& x,
+                          double* gradients) const;
+    // lowerError = W^T * deltas
+    void shardedBackpropagate(std::size_t layer, const std::vector<double>& deltas, std::vector<double>& lowerError) const;
+    void shardedUpdate(std::size_t layer, const double* gradients, double learning_rate);
+    // W -= learning_rate * deltas x^T and b -= learning_rate * deltas, slice by slice
+    void shardedFusedUpdate(std::size_t layer, const std::vector<double>& deltas, const std::vector<double>& x,
+                            double learning_rate);
+    void applyActivation(std::size_t layer, const std::vector<double>& z, std::vector<double>& y) const;
+    void applyStochasticActivation(std::size_t layer, std::vector<double>& z, std::vector<double>& y);
+
+    // Per-thread buffers for the read-only inference path
+    // Ping-pong buffers as in planMemory(false): every layer reads layerInput, writes its pre-activations to
+    // preActivations and its output back over the input it no longer needs
+    struct InferenceScratch {
+        std::vector<double> layerInput;
+        std::vector<double> preActivations;
+        std::vector<BFloat16> activationBF16;
+    };
+    const std::vector<double>& inferLogits(const std::vector<double>& input, InferenceScratch& scratch) const;
+
+    // One evaluation sample: input and target point either into the caller's data or into the buffers
+    struct SampleView {
+        const std::vector<double>* input = nullptr;
+        const std::vector<double>* target = nullptr;
+        std::vector<double> inputBuffer;
+        std::vector<double> targetBuffer;
+    };
+    template <typename SampleFn>
+    EvaluationResult evaluateSamples(std::size_t count, std::size_t classes, std::size_t topK, SampleFn&& loadSample) const;
+    // Each epoch trains on the first 1/EpochSampleDivisor of the shuffled samples
+    static constexpr std::size_t EpochSampleDivisor = 100;
+    std::vector<std::size_t> shuffledOrder(std::size_t sampleCount, std::uint64_t epochKey) const;
+    // Evaluates a copy of the model on the held-out set; empty when there is nothing to validate
+    using ValidationFn = std::function<EvaluationResult(const NeuralNetwork&)>;
+    static ValidationFn validationOn(const Dataset* validation);
+    // beginEpoch(epochKey) prepares the sample order, step(i) trains the i-th sample of it and returns its loss.
+    // Each epoch is validated on a snapshot of its weights while the next one trains.
+    template <typename BeginFn, typename StepFn>
+    void trainEpochs(int epochs, std::size_t samplesPerEpoch, BeginFn&& beginEpoch, StepFn&& step,
+                     const ValidationFn& validate);
+    // trainEpochs for training loops outside this file, e.g. Pipeline
+    void trainEpochsWith(int epochs, std::size_t samplesPerEpoch, const std::function<void(std::uint64_t)>& beginEpoch,
+                         const std::function<double(std::size_t)>& step, const ValidationFn& validate);
+    // Ping-pong buffers of the backward pass, see planMemory
+    std::vector<double> deltaScratch;
+    std::array<std::vector<double>, 2> errorScratch;
+    // Walks the layers from the output down and hands each one's clipped deltas and input to
+    // useDeltas(layer, deltas, x): before the error below is propagated, or after it when useDeltas
+    // updates the weights the propagation reads
+    template <typename DeltaFn>
+    void backwardDeltas(const std::vector<double>& outputError, bool updatesWeights, DeltaFn&& useDeltas);
+    // SGD step fused into the backward pass, no gradient is ever stored
+    void backPropagateDelta(const std::vector<double>& outputError, double learning_rate);
+    // Called with each layer's [begin, end) in the flat gradient as soon as it is final, output layer first
+    using GradientReadyFn = std::function<void(std::size_t begin, std::size_t end)>;
+    void backwardGradients(const std::vector<double>& outputError, double* gradients,
+                           const GradientReadyFn& layerReady = nullptr);
+    void applyGradientStep(const double* gradients, double learning_rate);
+
+    void appendModel(std::vector<char>& out) const;
+    static NeuralNetwork readModel(ByteReader& reader);
+
 public:
     explicit NeuralNetwork(unsigned long long input_size);
 
     void setLearningRate(double value);
+    // Fixes every random draw (initialization, shuffling, dropout) regardless of the thread count,
+    // call before add_layer
+    void setSeed(std::uint64_t seed);
+    // bf16 working weights, and bf16 hidden activations between the forward and backward pass of training
+    void setMixedPrecision(bool enabled);
+    // Applies to the layers added afterwards. Sharded layers compute in fp64 even with mixed precision.
+    void setSharding(const ShardingConfig& config);
+    // Keep the activations of every k-th layer only and recompute the rest during backpropagation, trading
+    // about one extra forward pass per sample for activation memory. 1 keeps everything.
+    void setActivationCheckpointing(std::size_t every);
+    // Picks the smallest k whose stored activations fit in bytes, or the k that stores the least if none
+    // does, and applies it. Call after the last add_layer; returns k.
+    std::size_t setActivationMemoryBudget(std::size_t bytes);
+    // Bytes of z and y held between the forward and backward pass of one sample with checkpointing every k
+    [[nodiscard]] std::size_t activationBytes(std::size_t every) const;
+    // Lifetimes and arena offsets of every buffer one sample needs: layer inputs, pre-activations, outputs,
+    // bf16 copies and, when training, dropout masks, recomputed segments, deltas and propagated errors of the
+    // fused SGD step. Forward step 2i multiplies layer i and 2i + 1 applies its activation, the softmax is step
+    // 2L - 1 and backward step 2L + (L - 1 - i) handles layer i. Call after the last add_layer.
+    [[nodiscard]] MemoryPlan planMemory(bool training) const;
+    // Runs the fp64 W * x + b of unsharded layers with the block size and task split KernelTuner measured
+    // fastest for the layer's shape, benchmarking shapes its cache does not know yet. Applies to the layers
+    // present and to those added later; results are unchanged.
+    void setKernelAutotuning(bool enabled);
     void addWeightLayer(const std::vector<std::vector<double>>& weights);
 
     void forwardPass(const std::vector<double>& input);
 
-    void add_layer(unsigned long long layer_size);
+    // The newest layer always feeds the softmax cross-entropy head, so its activation takes effect
+    // once another layer is added on top of it
+    void add_layer(unsigned long long layer_size, ActivationType activation = ActivationType::Sigmoid);
+    // Regularize the newest layer's output during training, inference is unaffected. Like the activation, it
+    // takes effect once another layer is added on top; training with it still on the output layer throws.
+    void add_dropout(double rate);
+    void add_gaussian_noise(double stddev);
 
     void printStructure();
 
     void backPropagate(const std::vector<double>& actual, const std::vector<double>& expected, double learning_rate);
 
+    // One SGD step on a single sample, returns its cross-entropy loss
+    double trainSample(const std::vector<double>& input, const std::vector<double>& expected);
+    double trainSample(const std::vector<double>& input, std::size_t label);
+
+    // Weights plus biases, the length of a flat gradient vector
+    [[nodiscard]] std::size_t parameterCount() const;
+    // Forward and backward pass on one sample without touching the weights. gradients is laid out layer by
+    // layer as row-major weight gradients followed by bias gradients. Returns the loss.
+    double computeGradients(const std::vector<double>& input, std::size_t label, std::vector<double>& gradients);
+    // One SGD step with gradients computed elsewhere, e.g. averaged over data-parallel replicas
+    void applyGradients(const std::vector<double>& gradients);
+    // Data-parallel replica: takes this rank's share of every shuffled epoch and averages gradients with the
+    // other ranks after each sample, so all replicas apply identical steps. Buckets of finished layers are
+    // submitted during the backward pass. Replicas must start from the same weights and seed, which keys the
+    // shared shuffle. Validation runs on rank 0 only.
+    void trainReplica(const Dataset &data, int epochs, GradientAllreduce &allreduce,
+                      const Dataset *validation = nullptr);
+
     void train(const std::vector<std::vector<double>> &input, std::vector<std::vector<double>> &expected, int epochs);
+    // Same as above, evaluating the held-out set after every epoch
+    void train(const std::vector<std::vector<double>> &input, std::vector<std::vector<double>> &expected, int epochs,
+               const std::vector<std::vector<double>> &validationInput,
+               const std::vector<std::vector<double>> &validationExpected);
+
+    // Features are normalized from the uint8 store while each sample is assembled
+    void train(const Dataset &data, int epochs, const Dataset *validation = nullptr);
+    // Streams the epochs from disk, memory stays bounded by the shard readahead and shuffle window
+    void train(ShardedDataset &data, int epochs, const Dataset *validation = nullptr);
+
+    // Loss, accuracy, top-k accuracy and confusion matrix in one parallel sweep, does not modify the network
+    EvaluationResult evaluate(const std::vector<std::vector<double>> &input,
+                              const std::vector<std::vector<double>> &expected, std::size_t topK = 5) const;
+    EvaluationResult evaluate(const Dataset &data, std::size_t topK = 5) const;
+
+    // Keeps training on labelled rows as they arrive until the stream ends, returns the samples consumed.
+    // Snapshots for inference are written with save(), readers never see a partial file.
+    std::size_t trainOnline(SampleStream &stream, const OnlineTrainingConfig &config);
 
     std::vector<double> predict(const std::vector<double> &input);
+    // Read-only prediction that never touches the training buffers, so several threads may call it
+    // on a network nobody is training, e.g. a ModelSnapshot
+    [[nodiscard]] std::vector<double> infer(const std::vector<double> &input) const;
+
+    // Publishes the current weights now and after every everySamples trained samples; nullptr stops
+    void publishSnapshots(SnapshotPublisher *publisher, std::size_t everySamples);
+    [[nodiscard]] std::uint64_t samplesTrained() const { return trainStep; }
+
+    [[nodiscard]] std::size_t inputSize() const;
+
+    // Layer shapes, activations, weights and biases. The file is written next to path and renamed over it.
+    void save(const std::string &path) const;
+    static NeuralNetwork load(const std::string &path);
+
+    // Model plus everything needed to continue training bit-exactly: learning rate, regularization,
+    // RNG seed and the step/epoch position. out is overwritten.
+    void checkpointState(std::vector<char> &out) const;
+    static NeuralNetwork restoreCheckpoint(const std::vector<char> &state, const std::string &source);
+    static NeuralNetwork restoreCheckpoint(const std::string &path);
+    // Restores the weights and training state of a checkpoint of this same architecture into this network,
+    // keeping its runtime settings (checkpointing, sharding, precision, autotuning, attachments) and the
+    // placement of its weight pages. Throws and leaves the network untouched if the shapes differ.
+    void loadCheckpointState(const std::vector<char> &state, const std::string &source);
+    // Hands the state to checkpointer after every everySamples trained samples; nullptr stops
+    void setCheckpointer(Checkpointer *checkpointer, std::size_t everySamples);
+    [[nodiscard]] std::uint64_t epochsCompleted() const { return epochCounter; }
 };
 
 #endif // NEURALNETWORK_H
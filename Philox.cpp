@@ -0,0 +1,104 @@
+#include "Philox.h"
+
+#include <cmath>
+#include <numbers>
+#include <utility>
+
+namespace {
+    constexpr std::uint32_t Multiplier0 = 0xD2511F53u;
+    constexpr std::uint32_t Multiplier1 = 0xCD9E8D57u;
+    constexpr std::uint32_t Weyl0 = 0x9E3779B9u;
+    constexpr std::uint32_t Weyl1 = 0xBB67AE85u;
+    constexpr int Rounds = 10;
+
+    // Top 53 bits of a 64-bit word mapped to [0, 1)
+    inline double toUnit(const std::uint32_t high, const std::uint32_t low) {
+        const std::uint64_t word = (static_cast<std::uint64_t>(high) << 32) | low;
+        return static_cast<double>(word >> 11) * 0x1.0p-53;
+    }
+}
+
+std::array<std::uint32_t, 4> Philox::block(const std::uint64_t stream, const std::uint64_t index) const {
+    std::uint32_t c0 = static_cast<std::uint32_t>(index);
+    std::uint32_t c1 = static_cast<std::uint32_t>(index >> 32);
+    std::uint32_t c2 = static_cast<std::uint32_t>(stream);
+    std::uint32_t c3 = static_cast<std::uint32_t>(stream >> 32);
+    std::uint32_t k0 = static_cast<std::uint32_t>(seed);
+    std::uint32_t k1 = static_cast<std::uint32_t>(seed >> 32);
+
+    for (int round = 0; round < Rounds; ++round) {
+        const std::uint64_t product0 = static_cast<std::uint64_t>(Multiplier0) * c0;
+        const std::uint64_t product1 = static_cast<std::uint64_t>(Multiplier1) * c2;
+        const auto hi0 = static_cast<std::uint32_t>(product0 >> 32);
+        const auto lo0 = static_cast<std::uint32_t>(product0);
+        const auto hi1 = static_cast<std::uint32_t>(product1 >> 32);
+        const auto lo1 = static_cast<std::uint32_t>(product1);
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += Weyl0;
+        k1 += Weyl1;
+    }
+    return {c0, c1, c2, c3};
+}
+
+void Philox::uniform(const std::uint64_t stream, const std::uint64_t first, double* out, const std::size_t count) const {
+    // Two doubles per block: element i lives in block i / 2, half i % 2
+    for (std::size_t i = 0; i < count;) {
+        const std::uint64_t element = first + i;
+        const auto words = block(stream, element / 2);
+        if (element % 2 == 0) {
+            out[i++] = toUnit(words[0], words[1]);
+            if (i < count) {
+                out[i++] = toUnit(words[2], words[3]);
+            }
+        } else {
+            out[i++] = toUnit(words[2], words[3]);
+        }
+    }
+}
+
+void Philox::normal(const std::uint64_t stream, const std::uint64_t first, double* out, const std::size_t count,
+                    const double mean, const double stddev) const {
+    // Box-Muller: one block gives two uniforms and therefore the normal pair (2k, 2k + 1)
+    for (std::size_t i = 0; i < count;) {
+        const std::uint64_t element = first + i;
+        const auto words = block(stream, element / 2);
+        const double u1 = 1.0 - toUnit(words[0], words[1]); // (0, 1], keeps log finite
+        const double u2 = toUnit(words[2], words[3]);
+        const double radius = stddev * std::sqrt(-2.0 * std::log(u1));
+        const double angle = 2.0 * std::numbers::pi * u2;
+        if (element % 2 == 0) {
+            out[i++] = mean + radius * std::cos(angle);
+            if (i < count) {
+                out[i++] = mean + radius * std::sin(angle);
+            }
+        } else {
+            out[i++] = mean + radius * std::sin(angle);
+        }
+    }
+}
+
+void Philox::bits(const std::uint64_t stream, const std::uint64_t first, std::uint32_t* out, const std::size_t count) const {
+    for (std::size_t i = 0; i < count;) {
+        const std::uint64_t element = first + i;
+        const auto words = block(stream, element / 4);
+        for (std::size_t lane = element % 4; lane < 4 && i < count; ++lane) {
+            out[i++] = words[lane];
+        }
+    }
+}
+
+std::uint64_t Philox::below(const std::uint64_t stream, const std::uint64_t index, const std::uint64_t bound) const {
+    const auto words = block(stream, index);
+    const std::uint64_t word = (static_cast<std::uint64_t>(words[0]) << 32) | words[1];
+    return word % bound; // modulo bias is below 2^-32 for any realistic bound
+}
+
+void Philox::shuffle(const std::uint64_t stream, std::vector<std::size_t>& values) const {
+    for (std::size_t i = values.size(); i > 1; --i) {
+        const std::uint64_t j = below(stream, i, i);
+        std::swap(values[i - 1], values[j]);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Philox4x32-10 counter-based generator. Every output is a pure function of (seed, stream, index), so
+// any range can be generated by any thread in any order and the results stay bit-identical.
+class Philox {
+public:
+    // Stream purposes, combined with a sub-id (layer, epoch, ...) by Philox::stream()
+    enum Purpose : std::uint32_t { WeightInit = 1, Shuffle = 2, Dropout = 3, Noise = 4, ShardOrder = 5, ShuffleWindow = 6 };
+
+    explicit Philox(std::uint64_t seed = 0) : seed(seed) {}
+
+    [[nodiscard]] std::uint64_t getSeed() const { return seed; }
+
+    static std::uint64_t stream(const Purpose purpose, const std::uint64_t sub) {
+        return (static_cast<std::uint64_t>(purpose) << 56) ^ sub;
+    }
+
+    // One Philox block: 128 random bits for the counter (stream, index)
+    [[nodiscard]] std::array<std::uint32_t, 4> block(std::uint64_t stream, std::uint64_t index) const;
+
+    // Element i of a stream is the same whichever call produces it
+    void uniform(std::uint64_t stream, std::uint64_t first, double* out, std::size_t count) const; // [0, 1)
+    void normal(std::uint64_t stream, std::uint64_t first, double* out, std::size_t count,
+                double mean = 0.0, double stddev = 1.0) const;
+    // 32 random bits per element, for Bernoulli masks compared against a threshold
+    void bits(std::uint64_t stream, std::uint64_t first, std::uint32_t* out, std::size_t count) const;
+
+    // Uniform integer in [0, bound)
+    [[nodiscard]] std::uint64_t below(std::uint64_t stream, std::uint64_t index, std::uint64_t bound) const;
+
+    // Fisher-Yates driven by the stream
+    void shuffle(std::uint64_t stream, std::vector<std::size_t>& values) const;
+
+private:
+    std::uint64_t seed;
+};
+
+#endif //PHILOX_H
@@ -0,0 +1,413 @@
+#include "Pipeline.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "Dataset.h"
+#include "NeuralNetwork.h"
+#include "SystemTopology.h"
+#include "ThreadPool.h"
+#include "UtilityFunctions.h"
+
+Pipeline::Pipeline(NeuralNetwork& network, const PipelineConfig& config) : network(network), config(config) {
+    const auto& matrices = network.weightsMatrices;
+    if (matrices.empty()) {
+        throw std::invalid_argument("Empty network");
+    }
+    if (this->config.microBatch == 0 || this->config.queueDepth == 0) {
+        throw std::invalid_argument("Pipeline micro-batch and queue depth must be positive.");
+    }
+    std::size_t stageCount = config.stages > 0 ? config.stages : ThreadPool::instance().topology().recommendedThreads();
+    stageCount = std::clamp<std::size_t>(stageCount, 1, matrices.size());
+
+    gradientOffsets.resize(matrices.size() + 1, 0);
+    for (std::size_t layer = 0; layer < matrices.size(); ++layer) {
+        gradientOffsets[layer + 1] = gradientOffsets[layer] + matrices[layer].size() * (matrices[layer][0].size() + 1);
+    }
+    gradients.assign(gradientOffsets.back(), 0.0);
+
+    // Contiguous stages of roughly equal parameter count, each with at least one layer
+    const double perStage = static_cast<double>(gradientOffsets.back()) / static_cast<double>(stageCount);
+    std::size_t layer = 0;
+    for (std::size_t stage = 0; stage < stageCount; ++stage) {
+        auto current = std::make_unique<Stage>();
+        current->firstLayer = layer;
+        const std::size_t layersLeftForOthers = stageCount - stage - 1;
+        do {
+            ++layer;
+        } while (layer + layersLeftForOthers < matrices.size() &&
+                 static_cast<double>(gradientOffsets[layer]) < perStage * static_cast<double>(stage + 1));
+        current->endLayer = stage + 1 == stageCount ? matrices.size() : layer;
+        // 1F1B admits one sample per stage, GPipe a whole micro-batch: the training queues never fill up
+        const std::size_t inFlight = config.schedule == PipelineSchedule::GPipe ? config.microBatch : stageCount;
+        current->capacity = std::max(config.queueDepth, inFlight);
+        current->stash.resize(config.microBatch);
+        stages.push_back(std::move(current));
+    }
+    for (std::size_t stage = 0; stage < stages.size(); ++stage) {
+        stages[stage]->thread = std::thread(&Pipeline::runStage, this, stage);
+    }
+}
+
+Pipeline::~Pipeline() {
+    for (const auto& stage : stages) {
+        {
+            std::lock_guard lock(stage->mutex);
+            stage->stopping = true;
+        }
+        stage->changed.notify_all();
+        stage->spaceFree.notify_all();
+    }
+    for (const auto& stage : stages) {
+        stage->thread.join();
+    }
+}
+
+std::pair<std::size_t, std::size_t> Pipeline::stageLayers(const std::size_t stage) const {
+    return {stages.at(stage)->firstLayer, stages.at(stage)->endLayer};
+}
+
+void Pipeline::runStage(const std::size_t index) {
+    Stage& stage = *stages[index];
+    if (config.pinStages) {
+        const std::vector<int>& cpus = ThreadPool::instance().topology().cpus;
+        SystemTopology::pinCurrentThread(cpus[index % cpus.size()]);
+    }
+    while (true) {
+        Item item;
+        bool isBackward = false;
+        {
+            std::unique_lock lock(stage.mutex);
+            stage.changed.wait(lock, [&] { return stage.stopping || !stage.backward.empty() || !stage.forward.empty(); });
+            if (stage.stopping) {
+                return;
+            }
+            // Finishing a sample first frees its stash and lets the next update come sooner
+            isBackward = !stage.backward.empty();
+            std::deque<Item>& queue = isBackward ? stage.backward : stage.forward;
+            item = std::move(queue.front());
+            queue.pop_front();
+            stage.busy = true;
+        }
+        if (!isBackward) {
+            stage.spaceFree.notify_one();
+        }
+        // A sample of a cancelled request is dropped, its request's state may be gone
+        if (item.generation == generation.load()) {
+            try {
+                if (isBackward) {
+                    backwardStage(index, item);
+                } else {
+                    forwardStage(index, item);
+                }
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        }
+        {
+            std::lock_guard lock(stage.mutex);
+            stage.busy = false;
+        }
+        stage.idle.notify_all();
+    }
+}
+
+void Pipeline::pushForward(const std::size_t index, Item item) {
+    Stage& stage = *stages[index];
+    {
+        std::unique_lock lock(stage.mutex);
+        stage.spaceFree.wait(lock, [&] { return stage.stopping || stage.forward.size() < stage.capacity; });
+        if (stage.stopping) {
+            return;
+        }
+        stage.forward.push_back(std::move(item));
+    }
+    stage.changed.notify_one();
+}
+
+void Pipeline::pushBackward(const std::size_t index, Item item) {
+    Stage& stage = *stages[index];
+    {
+        std::lock_guard lock(stage.mutex);
+        stage.backward.push_back(std::move(item));
+    }
+    stage.changed.notify_one();
+}
+
+void Pipeline::complete(const double loss) {
+    {
+        std::lock_guard lock(progressMutex);
+        ++completed;
+        batchLoss += loss;
+    }
+    progressChanged.notify_all();
+}
+
+void Pipeline::fail(std::exception_ptr error) {
+    {
+        std::lock_guard lock(progressMutex);
+        if (!failure) {
+            failure = std::move(error);
+        }
+    }
+    progressChanged.notify_all();
+}
+
+void Pipeline::cancel() {
+    {
+        std::lock_guard lock(progressMutex);
+        ++generation;
+        results = nullptr;
+    }
+    // Last stage first: a stage blocked handing a sample on is freed by clearing the queue after it
+    for (std::size_t index = stages.size(); index-- > 0;) {
+        Stage& stage = *stages[index];
+        {
+            std::unique_lock lock(stage.mutex);
+            stage.forward.clear();
+            stage.backward.clear();
+            stage.spaceFree.notify_all();
+            stage.idle.wait(lock, [&] { return !stage.busy; });
+        }
+    }
+    std::fill(gradients.begin(), gradients.end(), 0.0);
+    std::lock_guard lock(progressMutex);
+    fed = completed = 0;
+    batchLoss = 0.0;
+    failure = nullptr;
+}
+
+template <typename Ready>
+void Pipeline::waitForProgress(Ready&& ready) {
+    std::unique_lock lock(progressMutex);
+    progressChanged.wait(lock, [&] { return failure || ready(); });
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+// z = W x + b on the calling thread, rows summed in the same order as the pooled kernel
+static void stageLinear(const std::vector<std::vector<double>>& weights, const std::vector<double>& biases,
+                        const std::vector<double>& x, std::vector<double>& z) {
+    z.resize(weights.size());
+    for (std::size_t row = 0; row < weights.size(); ++row) {
+        const std::vector<double>& w = weights[row];
+        double sum = 0.0;
+        for (std::size_t col = 0; col < x.size(); ++col) {
+            sum += w[col] * x[col];
+        }
+        z[row] = sum + biases[row];
+    }
+}
+
+void Pipeline::forwardStage(const std::size_t index, Item& item) {
+    const Stage& stage = *stages[index];
+    const std::size_t outputLayer = network.weightsMatrices.size() - 1;
+    Stash scratch;
+    Stash& stash = item.training ? stages[index]->stash[item.index] : scratch;
+    const std::size_t layers = stage.endLayer - stage.firstLayer;
+    stash.input = std::move(item.values);
+    stash.preActivations.resize(layers);
+    stash.outputs.resize(layers);
+    stash.masks.resize(layers);
+
+    std::vector<double>* current = &stash.input;
+    for (std::size_t layer = stage.firstLayer; layer < stage.endLayer; ++layer) {
+        const std::size_t local = layer - stage.firstLayer;
+        std::vector<double>& z = stash.preActivations[local];
+        stageLinear(network.weightsMatrices[layer], network.biasVectors[layer], *current, z);
+        if (layer == outputLayer) {
+            break;
+        }
+        std::vector<double>& y = stash.outputs[local];
+        y.resize(z.size());
+        const ActivationKernels& kernels = network.layerKernels[layer];
+        if (item.training && (network.layerDropout[layer] > 0.0 || network.layerNoise[layer] > 0.0)) {
+            // The same streams NeuralNetwork::applyStochasticActivation draws for this step
+            stash.masks[local].resize((z.size() + MaskTile - 1) / MaskTile);
+            StochasticContext context;
+            context.rng = &network.rng;
+            context.noiseStream = Philox::stream(Philox::Noise, (item.step << 16) | layer);
+            context.dropoutStream = Philox::stream(Philox::Dropout, (item.step << 16) | layer);
+            context.noiseStddev = network.layerNoise[layer];
+            context.dropoutRate = network.layerDropout[layer];
+            context.mask = stash.masks[local].data();
+            kernels.forwardStochastic(z.data(), y.data(), z.size(), context);
+        } else {
+            kernels.forward(z.data(), y.data(), z.size());
+        }
+        current = &y;
+    }
+
+    if (index + 1 < stages.size()) {
+        // Training keeps the activations for the backward pass, inference hands them on
+        Item next{item.index, item.label, item.step, item.training,
+                  item.training ? *current : std::move(*current), item.generation};
+        pushForward(index + 1, std::move(next));
+        return;
+    }
+    const std::vector<double>& logits = stash.preActivations.back();
+    if (!item.training) {
+        std::vector<double> probabilities = UtilityFunctions::Softmax(logits);
+        {
+            std::lock_guard lock(progressMutex);
+            if (results != nullptr) { // null once the request was cancelled
+                (*results)[item.index] = std::move(probabilities);
+            }
+        }
+        complete(0.0);
+        return;
+    }
+    // The last stage turns straight around into the backward pass
+    std::vector<double> probabilities;
+    Item back{item.index, item.label, item.step, true, {}, item.generation};
+    const double loss = UtilityFunctions::SoftmaxCrossEntropy(logits, item.label, probabilities, back.values);
+    {
+        std::lock_guard lock(progressMutex);
+        batchLoss += loss;
+    }
+    backwardStage(index, back);
+}
+
+void Pipeline::backwardStage(const std::size_t index, Item& item) {
+    const Stage& stage = *stages[index];
+    Stash& stash = stages[index]->stash[item.index];
+    const std::size_t outputLayer = network.weightsMatrices.size() - 1;
+    std::vector<double> error = std::move(item.values);
+    std::vector<double> deltas;
+    std::vector<double> lower;
+
+    for (std::size_t layer = stage.endLayer; layer-- > stage.firstLayer;) {
+        const std::size_t local = layer - stage.firstLayer;
+        const auto& weights = network.weightsMatrices[layer];
+        const std::size_t rows = weights.size();
+        const std::size_t cols = weights[0].size();
+        const std::vector<double>& x = local == 0 ? stash.input : stash.outputs[local - 1];
+
+        deltas.resize(rows);
+        if (layer == outputLayer) {
+            std::copy(error.begin(), error.end(), deltas.begin());
+        } else {
+            const ActivationKernels& kernels = network.layerKernels[layer];
+            const double dropout = network.layerDropout[layer];
+            if (dropout > 0.0) {
+                kernels.backwardMasked(stash.preActivations[local].data(), stash.outputs[local].data(), error.data(),
+                                       deltas.data(), rows, stash.masks[local].data(), 0, dropout);
+            } else {
+                kernels.backward(stash.preActivations[local].data(), stash.outputs[local].data(), error.data(),
+                                 deltas.data(), rows);
+            }
+        }
+
+        // Each stage accumulates only into its own layers' part of the gradient
+        double* weightGradients = gradients.data() + gradientOffsets[layer];
+        double* biasGradients = weightGradients + rows * cols;
+        constexpr double gradient_clip_threshold = 5.0;
+        for (std::size_t neuron = 0; neuron < rows; ++neuron) {
+            const double delta = std::max(std::min(deltas[neuron], gradient_clip_threshold), -gradient_clip_threshold);
+            deltas[neuron] = delta;
+            double* row = weightGradients + neuron * cols;
+            for (std::size_t weight = 0; weight < cols; ++weight) {
+                row[weight] += delta * x[weight];
+            }
+            biasGradients[neuron] += delta;
+        }
+        if (layer == 0) {
+            break;
+        }
+        lower.assign(cols, 0.0);
+        for (std::size_t neuron = 0; neuron < rows; ++neuron) {
+            const double delta = deltas[neuron];
+            const std::vector<double>& row = weights[neuron];
+            for (std::size_t weight = 0; weight < cols; ++weight) {
+                lower[weight] += delta * row[weight];
+            }
+        }
+        std::swap(error, lower);
+    }
+
+    if (index > 0) {
+        pushBackward(index - 1, Item{item.index, item.label, item.step, true, std::move(error), item.generation});
+    } else {
+        complete(0.0);
+    }
+}
+
+std::vector<std::vector<double>> Pipeline::predict(const std::vector<std::vector<double>>& inputs) {
+    std::lock_guard run(runMutex);
+    // Checked up front, nothing is in flight yet if one is wrong
+    for (const std::vector<double>& input : inputs) {
+        if (input.size() != network.inputSize()) {
+            throw std::invalid_argument("Input size does not match the network.");
+        }
+    }
+    std::vector<std::vector<double>> output(inputs.size());
+    {
+        std::lock_guard lock(progressMutex);
+        results = &output;
+    }
+    // Declared after output: a failing stage leaves samples in flight, they are dropped before output goes away
+    const RequestScope scope{*this};
+    const std::uint64_t request = generation.load();
+    for (std::size_t i = 0; i < inputs.size(); ++i) {
+        // Blocks while the first stage is queueDepth samples behind
+        pushForward(0, Item{i, 0, 0, false, inputs[i], request});
+        {
+            std::lock_guard lock(progressMutex);
+            ++fed;
+        }
+        // Surfaces a failed stage instead of feeding it the rest of the request
+        waitForProgress([] { return true; });
+    }
+    waitForProgress([&] { return completed == fed; });
+    return output;
+}
+
+void Pipeline::feed(const std::vector<double>& features, const std::size_t label) {
+    const std::size_t inFlight = config.schedule == PipelineSchedule::GPipe ? config.microBatch : stages.size();
+    waitForProgress([&] { return fed - completed < inFlight; });
+    pushForward(0, Item{fed, label, network.trainStep + fed, true, features, generation.load()});
+    std::lock_guard lock(progressMutex);
+    ++fed;
+}
+
+double Pipeline::flush() {
+    waitForProgress([&] { return completed == fed; });
+    const std::size_t samples = fed;
+    const double loss = batchLoss;
+    // Summed gradients, averaged over the micro-batch by the step size
+    network.applyGradientStep(gradients.data(), network.learning_rate / static_cast<double>(samples));
+    std::fill(gradients.begin(), gradients.end(), 0.0);
+    {
+        std::lock_guard lock(progressMutex);
+        fed = completed = 0;
+        batchLoss = 0.0;
+    }
+    for (std::size_t i = 0; i < samples; ++i) {
+        network.afterTrainStep();
+    }
+    return loss;
+}
+
+void Pipeline::train(const Dataset& data, const int epochs, const Dataset* validation) {
+    if (!data.hasLabels()) {
+        throw std::invalid_argument("Training data has no labels.");
+    }
+    network.checkOutputRegularization();
+    std::lock_guard run(runMutex);
+    const RequestScope scope{*this};
+    const std::size_t samplesPerEpoch = data.size() / NeuralNetwork::EpochSampleDivisor;
+    std::vector<std::size_t> order;
+    std::vector<double> features;
+    network.trainEpochsWith(epochs, samplesPerEpoch,
+                            [&](const std::uint64_t epochKey) {
+                                order = network.shuffledOrder(data.size(), epochKey);
+                            },
+                            [&](const std::size_t i) {
+                                data.features(order[i], features);
+                                feed(features, data.label(order[i]));
+                                // The loss of a micro-batch is reported with its last sample
+                                return fed == config.microBatch || i + 1 == samplesPerEpoch ? flush() : 0.0;
+                            },
+                            NeuralNetwork::validationOn(validation));
+}
@@ -0,0 +1,131 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class Dataset;
+class NeuralNetwork;
+
+enum class PipelineSchedule {
+    GPipe,                 // all forwards of a micro-batch, then all backwards: most activations held
+    OneForwardOneBackward  // at most one sample in flight per stage, stages alternate forward and backward
+};
+
+struct PipelineConfig {
+    std::size_t stages = 0;     // 0: one per layer, capped by the CPUs available
+    std::size_t queueDepth = 4; // samples buffered between neighbouring stages during inference
+    std::size_t microBatch = 16; // samples whose averaged gradients make one weight update
+    PipelineSchedule schedule = PipelineSchedule::OneForwardOneBackward;
+    bool pinStages = false;     // pin every stage thread to its own CPU
+};
+
+// Pipeline-parallel execution: the layers are split into contiguous stages of roughly equal weight size,
+// each run by its own thread, and samples flow from stage to stage through bounded queues. A stage only ever
+// touches its own layers, so they stay in that core's private caches instead of the whole model streaming
+// through the shared LLC. Stage kernels run serially on their thread and in fp64.
+//
+// Training is synchronous: weights are updated once per micro-batch, after every sample of it has come back
+// through the backward pass, so stages never see a half-updated model. With a micro-batch of one this is the
+// plain per-sample SGD of NeuralNetwork::train. The network's layers must not change while a pipeline exists.
+class Pipeline {
+public:
+    explicit Pipeline(NeuralNetwork& network, const PipelineConfig& config = {});
+    ~Pipeline();
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // Softmax probabilities of every input, streamed through the stages, in input order
+    std::vector<std::vector<double>> predict(const std::vector<std::vector<double>>& inputs);
+    // Same epochs, shuffle and checkpoints as NeuralNetwork::train(const Dataset&, ...)
+    void train(const Dataset& data, int epochs, const Dataset* validation = nullptr);
+
+    [[nodiscard]] std::size_t stageCount() const { return stages.size(); }
+    // Layers [first, second) owned by stage
+    [[nodiscard]] std::pair<std::size_t, std::size_t> stageLayers(std::size_t stage) const;
+
+private:
+    struct Item {
+        std::size_t index = 0;   // slot in the micro-batch, or position in the predict() request
+        std::size_t label = 0;
+        std::uint64_t step = 0;  // training step of the sample, keys its dropout and noise streams
+        bool training = false;
+        std::vector<double> values; // forward: stage input, backward: error of the stage output
+        std::uint64_t generation = 0; // request the sample belongs to, stale ones are dropped unprocessed
+    };
+
+    // Activations a stage keeps from a sample's forward pass until its backward pass
+    struct Stash {
+        std::vector<double> input;
+        std::vector<std::vector<double>> preActivations;
+        std::vector<std::vector<double>> outputs;
+        std::vector<std::vector<std::uint64_t>> masks;
+    };
+
+    struct Stage {
+        std::size_t firstLayer = 0;
+        std::size_t endLayer = 0;
+        std::thread thread;
+        std::vector<Stash> stash; // indexed by micro-batch slot
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::condition_variable spaceFree;
+        std::deque<Item> forward;  // bounded by capacity
+        std::deque<Item> backward; // bounded by the samples in flight, served first
+        std::size_t capacity = 1;
+        bool stopping = false;
+        bool busy = false;          // processing an item it popped
+        std::condition_variable idle;
+    };
+
+    NeuralNetwork& network;
+    PipelineConfig config;
+    std::vector<std::unique_ptr<Stage>> stages;
+    std::vector<std::size_t> gradientOffsets; // of each layer in the flat gradient
+    std::vector<double> gradients;            // summed over the micro-batch, each stage writes its own layers
+    std::vector<std::vector<double>>* results = nullptr;
+
+    std::mutex runMutex; // one predict() or train() at a time
+    std::mutex progressMutex;
+    std::condition_variable progressChanged;
+    std::size_t fed = 0;
+    std::size_t completed = 0;
+    double batchLoss = 0.0;
+    std::exception_ptr failure;
+    std::atomic<std::uint64_t> generation{0}; // bumped by cancel()
+
+    // Ends the request in progress when predict() or train() returns or unwinds
+    struct RequestScope {
+        Pipeline& pipeline;
+        ~RequestScope() { pipeline.cancel(); }
+    };
+
+    void runStage(std::size_t stage);
+    void forwardStage(std::size_t stage, Item& item);
+    void backwardStage(std::size_t stage, Item& item);
+    void pushForward(std::size_t stage, Item item);
+    void pushBackward(std::size_t stage, Item item);
+    void complete(double loss);
+    void fail(std::exception_ptr error);
+    // Drops the samples still in flight, waits until no stage works on one, then resets the progress counters,
+    // the failure and the gradients so the next request starts clean
+    void cancel();
+    // Blocks until ready() holds under progressMutex, rethrowing a stage failure
+    template <typename Ready>
+    void waitForProgress(Ready&& ready);
+    void feed(const std::vector<double>& features, std::size_t label);
+    double flush();
+};
+
+#endif //PIPELINE_H
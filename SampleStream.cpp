@@ -0,0 +1,261 @@
+#include "SampleStream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+SampleStream::SampleStream(const std::string& source, const std::size_t classCount)
+    : name(source), classes(classCount) {
+    static constexpr std::string_view SocketPrefix = "unix:";
+#ifdef __linux__
+    if (source == "-") {
+        fd = STDIN_FILENO;
+    } else if (source.starts_with(SocketPrefix)) {
+        const std::string path = source.substr(SocketPrefix.size());
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw std::invalid_argument("Socket path too long: " + path);
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            throw std::runtime_error("Unable to connect to socket: " + path);
+        }
+        ownsInput = true;
+    } else {
+        fd = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Unable to open file: " + source);
+        }
+        ownsInput = true;
+    }
+#else
+    if (source == "-") {
+        file = stdin;
+    } else if (source.starts_with(SocketPrefix)) {
+        throw std::runtime_error("Unix socket streams are only supported on Linux: " + source);
+    } else {
+        file = std::fopen(source.c_str(), "rb");
+        if (file == nullptr) {
+            throw std::runtime_error("Unable to open file: " + source);
+        }
+        ownsInput = true;
+    }
+#endif
+    buffer.resize(ChunkBytes);
+}
+
+SampleStream::~SampleStream() {
+    if (!ownsInput) {
+        return;
+    }
+#ifdef __linux__
+    ::close(fd);
+#else
+    std::fclose(file);
+#endif
+}
+
+bool SampleStream::fill(const bool block) {
+    // Keep the unread tail at the front so the buffer only grows for rows longer than a chunk
+    if (begin > 0) {
+        std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+    }
+    if (buffer.size() - end < ChunkBytes / 2) {
+        buffer.resize(buffer.size() + ChunkBytes);
+    }
+#ifdef __linux__
+    if (!block) {
+        pollfd request{fd, POLLIN, 0};
+        if (::poll(&request, 1, 0) <= 0) {
+            return false;
+        }
+    }
+    ssize_t count;
+    do {
+        count = ::read(fd, buffer.data() + end, buffer.size() - end);
+    } while (count < 0 && errno == EINTR);
+    if (count < 0) {
+        throw std::runtime_error("Unable to read from " + name + ": " + std::strerror(errno));
+    }
+#else
+    // stdio offers no readiness check, a blocking line read is the best we can do
+    if (!block) {
+        return false;
+    }
+    std::size_t count = 0;
+    if (std::fgets(buffer.data() + end, static_cast<int>(buffer.size() - end), file) != nullptr) {
+        count = std::strlen(buffer.data() + end);
+    } else if (std::ferror(file)) {
+        throw std::runtime_error("Unable to read from " + name);
+    }
+#endif
+    if (count == 0) {
+        endOfStream = true;
+    }
+    end += static_cast<std::size_t>(count);
+    return true;
+}
+
+bool SampleStream::nextLine(const bool block, std::string_view& line) {
+    std::size_t scanned = begin;
+    while (true) {
+        const char* newline = static_cast<const char*>(std::memchr(buffer.data() + scanned, '\n', end - scanned));
+        if (newline != nullptr) {
+            const std::size_t length = newline - (buffer.data() + begin);
+            line = std::string_view(buffer.data() + begin, length);
+            begin += length + 1;
+            return true;
+        }
+        if (endOfStream) {
+            if (begin == end) {
+                return false;
+            }
+            line = std::string_view(buffer.data() + begin, end - begin);
+            begin = end;
+            return true;
+        }
+        if (end - begin > MaxLineBytes) {
+            throw std::runtime_error("Row longer than " + std::to_string(MaxLineBytes) + " bytes in " + name);
+        }
+        // fill() moves the unread bytes to the front, so only the new bytes still need scanning
+        scanned = end - begin;
+        if (!fill(block)) {
+            return false;
+        }
+    }
+}
+
+std::size_t SampleStream::featureCount() {
+    if (started) {
+        return features;
+    }
+    std::string_view line;
+    do {
+        if (!nextLine(true, line)) {
+            throw std::runtime_error("Stream ended before the first row: " + name);
+        }
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+    } while (line.empty());
+    features = static_cast<std::size_t>(std::ranges::count(line, ','));
+    if (features == 0) {
+        throw std::runtime_error("Rows need a label and at least one pixel in " + name);
+    }
+    // A leading header ("label,p0,...") is skipped, a data row is kept for the first batch
+    if (line.front() >= '0' && line.front() <= '9') {
+        firstRow = std::string(line);
+    }
+    row.resize(features);
+    started = true;
+    return features;
+}
+
+bool SampleStream::parseRow(const std::string_view line, Dataset& batch) {
+    std::uint8_t label = 0;
+    if (!Dataset::parseCsvRow(line, true, classes, row.data(), features, label, name)) {
+        return false;
+    }
+    batch.addSample(row.data(), label);
+    return true;
+}
+
+std::size_t SampleStream::readBatch(Dataset& batch, const std::size_t maxSamples) {
+    featureCount();
+    if (batch.featureCount() != features || batch.classCount() != classes) {
+        batch = Dataset(features, classes);
+    }
+    batch.clear();
+    if (!firstRow.empty() && maxSamples > 0) {
+        parseRow(firstRow, batch);
+        firstRow.clear();
+    }
+    std::string_view line;
+    while (batch.size() < maxSamples && nextLine(batch.empty(), line)) {
+        parseRow(line, batch);
+    }
+    return batch.size();
+}
+
+BatchReader::BatchReader(SampleStream& stream, const std::size_t batchSize, const std::size_t depth)
+    : stream(stream), batchSize(std::max<std::size_t>(batchSize, 1)) {
+    // One batch may be held by the consumer while the others are read
+    for (std::size_t i = 0; i < std::max<std::size_t>(depth, 2); ++i) {
+        batches.push_back(std::make_unique<Dataset>());
+        empty.push_back(batches.back().get());
+    }
+    reader = std::thread(&BatchReader::readLoop, this);
+}
+
+BatchReader::~BatchReader() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    reader.join();
+}
+
+const Dataset* BatchReader::next() {
+    std::unique_lock lock(mutex);
+    if (consumed != nullptr) {
+        empty.push_back(consumed);
+        consumed = nullptr;
+        changed.notify_all();
+    }
+    changed.wait(lock, [&] { return !filled.empty(); });
+    Dataset* batch = filled.front();
+    if (batch->empty()) {
+        // The end stays queued, so later calls see it too
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return nullptr;
+    }
+    filled.pop_front();
+    consumed = batch;
+    return batch;
+}
+
+void BatchReader::readLoop() {
+    std::unique_lock lock(mutex);
+    while (true) {
+        changed.wait(lock, [&] { return !empty.empty() || stopping; });
+        if (stopping) {
+            return;
+        }
+        Dataset* batch = empty.front();
+        empty.pop_front();
+        lock.unlock();
+        std::exception_ptr failure;
+        try {
+            stream.readBatch(*batch, batchSize);
+        } catch (...) {
+            failure = std::current_exception();
+            batch->clear();
+        }
+        lock.lock();
+        error = failure;
+        filled.push_back(batch);
+        changed.notify_all();
+        if (batch->empty()) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef SAMPLESTREAM_H
+#define SAMPLESTREAM_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "Dataset.h"
+
+// Labelled CSV rows ("label,p0,p1,...") arriving on stdin, a file or FIFO, or a Unix socket. An optional
+// header line is skipped and the feature count is taken from the first line. Memory stays bounded by one
+// read chunk plus the longest row, however long the stream runs.
+class SampleStream {
+public:
+    // "-" reads stdin, "unix:<path>" connects to a Unix socket, anything else is opened as a file or FIFO
+    explicit SampleStream(const std::string& source, std::size_t classCount = 10);
+    ~SampleStream();
+
+    SampleStream(const SampleStream&) = delete;
+    SampleStream& operator=(const SampleStream&) = delete;
+
+    // Blocks until the first line has arrived
+    std::size_t featureCount();
+    [[nodiscard]] std::size_t classCount() const { return classes; }
+
+    // Clears batch, blocks for one sample, then adds whatever complete rows are already available, up to
+    // maxSamples. Returns the number of samples read, 0 once the stream has ended.
+    std::size_t readBatch(Dataset& batch, std::size_t maxSamples);
+
+private:
+    static constexpr std::size_t ChunkBytes = 64 * 1024;
+    static constexpr std::size_t MaxLineBytes = 1 << 20;
+
+    std::string name;
+    std::size_t classes;
+    std::size_t features = 0;
+    bool started = false;
+    std::string firstRow; // first data row, read early to learn the feature count
+    std::vector<std::uint8_t> row;
+
+    int fd = -1;               // Linux: raw descriptor, so readiness can be polled
+    std::FILE* file = nullptr; // elsewhere: line-buffered stdio
+    bool ownsInput = false;
+    std::vector<char> buffer;
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    bool endOfStream = false;
+
+    // Appends bytes from the source; a non-blocking call returns false when none are ready yet
+    bool fill(bool block);
+    // Next complete line (without '\n'), valid until the next call; false at the end of the stream
+    // or, when not blocking, when no complete line is buffered
+    bool nextLine(bool block, std::string_view& line);
+    bool parseRow(std::string_view line, Dataset& batch);
+};
+
+// Reads batches from a SampleStream on one background thread that lives as long as the reader, up to depth
+// batches ahead of the consumer. The batches are allocated once and cycle between the thread and the
+// consumer, so memory stays at depth batches of rows.
+class BatchReader {
+public:
+    BatchReader(SampleStream& stream, std::size_t batchSize, std::size_t depth = 2);
+    // Waits for a read in progress, so it returns once the stream delivers a row or ends
+    ~BatchReader();
+
+    BatchReader(const BatchReader&) = delete;
+    BatchReader& operator=(const BatchReader&) = delete;
+
+    // Blocks for the next batch, valid until the next call; nullptr once the stream has ended. A failed read
+    // is rethrown here.
+    const Dataset* next();
+
+private:
+    SampleStream& stream;
+    std::size_t batchSize;
+    std::vector<std::unique_ptr<Dataset>> batches;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Dataset*> empty;  // waiting to be filled
+    std::deque<Dataset*> filled; // read, an empty batch marks the end of the stream
+    Dataset* consumed = nullptr; // handed out by the last next()
+    bool stopping = false;
+    std::exception_ptr error;
+    std::thread reader;
+
+    void readLoop();
+};
+
+#endif //SAMPLESTREAM_H
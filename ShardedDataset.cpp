@@ -0,0 +1,250 @@
+#include "ShardedDataset.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+static constexpr double PixelScale = 1.0 / 255.0;
+
+ShardedDataset::ShardedDataset(std::vector<std::string> shardPaths, const ShardedDatasetConfig config)
+    : config(config) {
+    if (shardPaths.empty()) {
+        throw std::invalid_argument("Sharded dataset needs at least one shard.");
+    }
+    this->config.readaheadShards = std::max<std::size_t>(this->config.readaheadShards, 1);
+    this->config.shuffleWindow = std::max<std::size_t>(this->config.shuffleWindow, 1);
+
+    // Only the headers are read up front, the sample data is streamed per epoch
+    for (auto& path : shardPaths) {
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            throw std::runtime_error("Unable to open file: " + path);
+        }
+        ShardHeader header;
+        try {
+            header = readHeader(file, path);
+        } catch (...) {
+            std::fclose(file);
+            throw;
+        }
+        std::fclose(file);
+        if (shards.empty()) {
+            features = header.features;
+            classes = header.classes;
+        } else if (header.features != features || header.classes != classes) {
+            throw std::runtime_error("Shard shape does not match the first shard: " + path);
+        }
+        totalSamples += header.samples;
+        shards.push_back({std::move(path), static_cast<std::size_t>(header.samples)});
+    }
+}
+
+ShardedDataset::~ShardedDataset() {
+    stopReader();
+}
+
+std::vector<std::string> ShardedDataset::writeShards(const Dataset& data, const std::string& prefix,
+                                                     const std::size_t samplesPerShard) {
+    if (!data.hasLabels()) {
+        throw std::invalid_argument("Only labelled datasets can be sharded.");
+    }
+    if (samplesPerShard == 0) {
+        throw std::invalid_argument("Shards need at least one sample.");
+    }
+    std::vector<std::string> paths;
+    const std::size_t featureCount = data.featureCount();
+    for (std::size_t first = 0; first < data.size(); first += samplesPerShard) {
+        const std::size_t count = std::min(samplesPerShard, data.size() - first);
+        char suffix[32];
+        std::snprintf(suffix, sizeof(suffix), "-%05zu.shard", paths.size());
+        const std::string path = prefix + suffix;
+
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            throw std::runtime_error("Unable to open file: " + path);
+        }
+        ShardHeader header;
+        header.features = static_cast<std::uint32_t>(featureCount);
+        header.classes = static_cast<std::uint32_t>(data.classCount());
+        header.samples = count;
+        std::vector<std::uint8_t> labels(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            labels[i] = data.label(first + i);
+        }
+        // Samples are contiguous in the dataset, so the pixels of a shard are one block
+        const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                             std::fwrite(labels.data(), 1, count, file) == count &&
+                             std::fwrite(data.pixels(first), 1, count * featureCount, file) == count * featureCount;
+        if (std::fclose(file) != 0 || !written) {
+            throw std::runtime_error("Unable to write shard: " + path);
+        }
+        paths.push_back(path);
+    }
+    return paths;
+}
+
+ShardHeader ShardedDataset::readHeader(std::FILE* file, const std::string& path) {
+    ShardHeader header;
+    static constexpr ShardHeader Expected;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+        std::memcmp(header.magic, Expected.magic, sizeof(header.magic)) != 0) {
+        throw std::runtime_error("Not a dataset shard: " + path);
+    }
+    return header;
+}
+
+ShardedDataset::LoadedShard ShardedDataset::loadShard(const ShardInfo& shard) const {
+    std::FILE* file = std::fopen(shard.path.c_str(), "rb");
+    if (file == nullptr) {
+        throw std::runtime_error("Unable to open file: " + shard.path);
+    }
+    // Whole-shard reads: no stdio buffering and, on Linux, an aggressive kernel readahead window
+    std::setvbuf(file, nullptr, _IONBF, 0);
+#ifdef __linux__
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    LoadedShard loaded;
+    try {
+        readHeader(file, shard.path);
+        loaded.samples = shard.samples;
+        loaded.labels.resize(shard.samples);
+        loaded.pixels.resize(shard.samples * features);
+        if (std::fread(loaded.labels.data(), 1, loaded.labels.size(), file) != loaded.labels.size() ||
+            std::fread(loaded.pixels.data(), 1, loaded.pixels.size(), file) != loaded.pixels.size()) {
+            throw std::runtime_error("Shard is truncated: " + shard.path);
+        }
+#ifdef __linux__
+        // The shard is read once per epoch, keep it from crowding out the page cache
+        posix_fadvise(fileno(file), 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    } catch (...) {
+        std::fclose(file);
+        throw;
+    }
+    std::fclose(file);
+    for (const std::uint8_t label : loaded.labels) {
+        if (label >= classes) {
+            throw std::runtime_error("Invalid label value " + std::to_string(label) + " in " + shard.path);
+        }
+    }
+    return loaded;
+}
+
+void ShardedDataset::beginEpoch(const Philox& rng, const std::uint64_t epoch) {
+    stopReader();
+
+    std::vector<std::size_t> order(shards.size());
+    std::iota(order.begin(), order.end(), 0);
+    rng.shuffle(Philox::stream(Philox::ShardOrder, epoch), order);
+    epochRng = rng;
+    windowStream = Philox::stream(Philox::ShuffleWindow, epoch);
+    draws = 0;
+
+    current = LoadedShard();
+    cursor = 0;
+    const std::size_t window = std::min(config.shuffleWindow, totalSamples);
+    windowPixels.resize(window * features);
+    windowLabels.resize(window);
+    windowCount = 0;
+    sourceExhausted = false;
+
+    readerDone = false;
+    readerError = nullptr;
+    reader = std::thread(&ShardedDataset::readerLoop, this, std::move(order));
+}
+
+void ShardedDataset::readerLoop(const std::vector<std::size_t> order) {
+    try {
+        for (const std::size_t shard : order) {
+            {
+                std::unique_lock lock(queueMutex);
+                queueChanged.wait(lock, [&] { return stopRequested || ready.size() < config.readaheadShards; });
+                if (stopRequested) {
+                    break;
+                }
+            }
+            LoadedShard loaded = loadShard(shards[shard]);
+            {
+                std::lock_guard lock(queueMutex);
+                ready.push_back(std::move(loaded));
+            }
+            queueChanged.notify_all();
+        }
+    } catch (...) {
+        std::lock_guard lock(queueMutex);
+        readerError = std::current_exception();
+    }
+    {
+        std::lock_guard lock(queueMutex);
+        readerDone = true;
+    }
+    queueChanged.notify_all();
+}
+
+void ShardedDataset::stopReader() {
+    if (!reader.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard lock(queueMutex);
+        stopRequested = true;
+    }
+    queueChanged.notify_all();
+    reader.join();
+    std::lock_guard lock(queueMutex);
+    stopRequested = false;
+    ready.clear();
+}
+
+bool ShardedDataset::pullSample(const std::size_t slot) {
+    while (cursor == current.samples) {
+        std::unique_lock lock(queueMutex);
+        queueChanged.wait(lock, [&] { return !ready.empty() || readerDone; });
+        if (readerError) {
+            std::rethrow_exception(readerError);
+        }
+        if (ready.empty()) {
+            sourceExhausted = true;
+            current = LoadedShard();
+            return false;
+        }
+        current = std::move(ready.front());
+        ready.pop_front();
+        cursor = 0;
+        lock.unlock();
+        queueChanged.notify_all();
+    }
+    std::memcpy(windowPixels.data() + slot * features, current.pixels.data() + cursor * features, features);
+    windowLabels[slot] = current.labels[cursor];
+    cursor++;
+    return true;
+}
+
+bool ShardedDataset::next(std::vector<double>& out, std::uint8_t& label) {
+    // Top the window up, then emit a random slot and fill the hole with the last one
+    while (!sourceExhausted && windowCount < windowLabels.size() && pullSample(windowCount)) {
+        windowCount++;
+    }
+    if (windowCount == 0) {
+        return false;
+    }
+    const std::size_t pick = windowCount > 1 ? epochRng.below(windowStream, draws++, windowCount) : 0;
+    const std::uint8_t* source = windowPixels.data() + pick * features;
+    out.resize(features);
+    for (std::size_t i = 0; i < features; ++i) {
+        out[i] = source[i] * PixelScale;
+    }
+    label = windowLabels[pick];
+
+    windowCount--;
+    if (pick != windowCount) {
+        std::memcpy(windowPixels.data() + pick * features, windowPixels.data() + windowCount * features, features);
+        windowLabels[pick] = windowLabels[windowCount];
+    }
+    return true;
+}
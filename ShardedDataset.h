@@ -0,0 +1,102 @@
+#ifndef SHARDEDDATASET_H
+#define SHARDEDDATASET_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Dataset.h"
+#include "Philox.h"
+
+// On-disk shard: this header, then `samples` uint8 labels, then samples * features uint8 pixels
+struct ShardHeader {
+    char magic[8] = {'N', 'N', 'S', 'H', 'A', 'R', 'D', '1'};
+    std::uint32_t features = 0;
+    std::uint32_t classes = 0;
+    std::uint64_t samples = 0;
+};
+
+struct ShardedDatasetConfig {
+    std::size_t shuffleWindow = 65536; // samples held for the within-window shuffle, 0 or 1 keeps shard order
+    std::size_t readaheadShards = 2;   // shards loaded ahead of the one being consumed
+};
+
+// Streams a dataset bigger than RAM from shard files. Each epoch visits the shards in a shuffled order
+// and shuffles samples inside a sliding window. A reader thread keeps readaheadShards shards loaded ahead,
+// so at most (readaheadShards + 1) shards plus the window are resident at any time.
+class ShardedDataset {
+public:
+    explicit ShardedDataset(std::vector<std::string> shardPaths, ShardedDatasetConfig config = {});
+    ~ShardedDataset();
+
+    ShardedDataset(const ShardedDataset&) = delete;
+    ShardedDataset& operator=(const ShardedDataset&) = delete;
+
+    // Splits data into shards of samplesPerShard samples named prefix-00000.shard, ... and returns their paths
+    static std::vector<std::string> writeShards(const Dataset& data, const std::string& prefix,
+                                                std::size_t samplesPerShard);
+
+    [[nodiscard]] std::size_t size() const { return totalSamples; }
+    [[nodiscard]] std::size_t featureCount() const { return features; }
+    [[nodiscard]] std::size_t classCount() const { return classes; }
+    [[nodiscard]] std::size_t shardCount() const { return shards.size(); }
+
+    // Restarts the stream; the shard order and window picks are keyed by (rng seed, epoch)
+    void beginEpoch(const Philox& rng, std::uint64_t epoch);
+    // Next sample of the epoch with features normalized to [0, 1]; false once the epoch is exhausted
+    bool next(std::vector<double>& out, std::uint8_t& label);
+
+private:
+    struct ShardInfo {
+        std::string path;
+        std::size_t samples = 0;
+    };
+
+    struct LoadedShard {
+        std::vector<std::uint8_t> labels;
+        std::vector<std::uint8_t> pixels;
+        std::size_t samples = 0;
+    };
+
+    std::vector<ShardInfo> shards;
+    ShardedDatasetConfig config;
+    std::size_t features = 0;
+    std::size_t classes = 0;
+    std::size_t totalSamples = 0;
+
+    // Reader thread state, guarded by queueMutex
+    std::thread reader;
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<LoadedShard> ready;
+    bool readerDone = true;
+    bool stopRequested = false;
+    std::exception_ptr readerError;
+
+    // Consumer state, only touched by the training thread
+    LoadedShard current;
+    std::size_t cursor = 0;
+    std::vector<std::uint8_t> windowPixels;
+    std::vector<std::uint8_t> windowLabels;
+    std::size_t windowCount = 0;
+    bool sourceExhausted = true;
+    Philox epochRng;
+    std::uint64_t windowStream = 0;
+    std::uint64_t draws = 0;
+
+    static ShardHeader readHeader(std::FILE* file, const std::string& path);
+    LoadedShard loadShard(const ShardInfo& shard) const;
+    void readerLoop(std::vector<std::size_t> order);
+    void stopReader();
+    // Moves the next sample in shard order into window slot `slot`; false when no samples are left
+    bool pullSample(std::size_t slot);
+};
+
+#endif //SHARDEDDATASET_H
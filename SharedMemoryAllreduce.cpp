@@ -0,0 +1,112 @@
+#include "SharedMemoryAllreduce.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// Spins briefly, then yields: peers are other processes, possibly sharing this CPU
+template <typename Ready>
+static void waitUntil(Ready&& ready) {
+    for (unsigned spins = 0; !ready(); ++spins) {
+        if (spins >= 64) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+SharedMemoryAllreduce::SharedMemoryAllreduce(const std::size_t ranks, const std::size_t count)
+    : ranks(ranks), elements(count), chunkCapacity((count + ranks - 1) / std::max<std::size_t>(ranks, 1)) {
+    if (ranks == 0) {
+        throw std::invalid_argument("Allreduce needs at least one rank.");
+    }
+    regionBytes = ranks * sizeof(Mailbox) + ranks * 2 * chunkCapacity * sizeof(double);
+#ifdef __linux__
+    region = ::mmap(nullptr, regionBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        throw std::runtime_error("Unable to map the allreduce buffers.");
+    }
+#else
+    if (ranks > 1) {
+        throw std::runtime_error("Multi-process allreduce is only supported on Linux.");
+    }
+    region = ::operator new(regionBytes, std::align_val_t{64});
+#endif
+    // std::atomic<uint64_t> is lock-free and address-free, so it works across processes in shared memory
+    mailboxes = new (region) Mailbox[ranks];
+    slots = reinterpret_cast<double*>(static_cast<char*>(region) + ranks * sizeof(Mailbox));
+}
+
+SharedMemoryAllreduce::~SharedMemoryAllreduce() {
+#ifdef __linux__
+    ::munmap(region, regionBytes);
+#else
+    ::operator delete(region, std::align_val_t{64});
+#endif
+}
+
+void SharedMemoryAllreduce::setRank(const std::size_t rank) {
+    if (rank >= ranks) {
+        throw std::invalid_argument("Rank out of range.");
+    }
+    self = rank;
+}
+
+void SharedMemoryAllreduce::send(const double* values, const std::size_t chunk) {
+    const std::size_t next = (self + 1) % ranks;
+    const std::uint64_t message = ++sent;
+    Mailbox& mailbox = mailboxes[next];
+    // The slot is free once the receiver has consumed the message sent two steps ago
+    waitUntil([&] { return message <= 2 || mailbox.consumed.load(std::memory_order_acquire) >= message - 2; });
+    double* slot = slots + (next * 2 + message % 2) * chunkCapacity;
+    const std::size_t begin = chunkBegin(chunk);
+    std::memcpy(slot, values + begin, (chunkBegin(chunk + 1) - begin) * sizeof(double));
+    mailbox.posted.store(message, std::memory_order_release);
+}
+
+template <typename Fn>
+void SharedMemoryAllreduce::receive(const std::size_t chunk, Fn&& fn) {
+    const std::uint64_t message = ++received;
+    Mailbox& mailbox = mailboxes[self];
+    waitUntil([&] { return mailbox.posted.load(std::memory_order_acquire) >= message; });
+    const double* slot = slots + (self * 2 + message % 2) * chunkCapacity;
+    fn(slot, chunkBegin(chunk), chunkBegin(chunk + 1) - chunkBegin(chunk));
+    mailbox.consumed.store(message, std::memory_order_release);
+}
+
+void SharedMemoryAllreduce::submit(double* values, const std::size_t begin, const std::size_t end) {
+    if (begin > end || end > elements) {
+        throw std::out_of_range("Allreduce range out of bounds.");
+    }
+    if (ranks == 1) {
+        return;
+    }
+    rangeBegin = begin;
+    rangeLength = end - begin;
+    // Reduce-scatter: after ranks - 1 steps this rank holds the full sum of chunk (self + 1) % ranks
+    for (std::size_t step = 0; step + 1 < ranks; ++step) {
+        send(values, (self + ranks - step) % ranks);
+        receive((self + 2 * ranks - step - 1) % ranks, [&](const double* slot, const std::size_t begin, const std::size_t length) {
+            for (std::size_t i = 0; i < length; ++i) {
+                values[begin + i] += slot[i];
+            }
+        });
+    }
+    const std::size_t owned = (self + 1) % ranks;
+    const double scale = 1.0 / static_cast<double>(ranks);
+    for (std::size_t i = chunkBegin(owned); i < chunkBegin(owned + 1); ++i) {
+        values[i] *= scale;
+    }
+    // Allgather: pass the finished chunks around the ring
+    for (std::size_t step = 0; step + 1 < ranks; ++step) {
+        send(values, (self + 1 + ranks - step) % ranks);
+        receive((self + ranks - step) % ranks, [&](const double* slot, const std::size_t begin, const std::size_t length) {
+            std::memcpy(values + begin, slot, length * sizeof(double));
+        });
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef SHAREDMEMORYALLREDUCE_H
+#define SHAREDMEMORYALLREDUCE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "GradientAllreduce.h"
+
+// Element-wise mean of a double vector across the processes of one host. The ring algorithm runs a
+// reduce-scatter and then an allgather, each rank passing one chunk per step to its successor through a
+// two-slot mailbox in an anonymous shared mapping. Every rank moves 2 * (ranks - 1) / ranks of the vector,
+// whatever the rank count. Submitted ranges are averaged before submit() returns.
+//
+// Create it before fork(): the children inherit the mapping, and each calls setRank() with its own index.
+class SharedMemoryAllreduce : public GradientAllreduce {
+public:
+    SharedMemoryAllreduce(std::size_t ranks, std::size_t count);
+    ~SharedMemoryAllreduce();
+
+    SharedMemoryAllreduce(const SharedMemoryAllreduce&) = delete;
+    SharedMemoryAllreduce& operator=(const SharedMemoryAllreduce&) = delete;
+
+    void setRank(std::size_t rank);
+    [[nodiscard]] std::size_t rank() const override { return self; }
+    [[nodiscard]] std::size_t size() const override { return ranks; }
+    [[nodiscard]] std::size_t count() const override { return elements; }
+
+    void submit(double* values, std::size_t begin, std::size_t end) override;
+    void wait() override {}
+
+private:
+    struct alignas(64) Mailbox {
+        std::atomic<std::uint64_t> posted{0};                // last message written into this rank's slots
+        alignas(64) std::atomic<std::uint64_t> consumed{0};  // last message this rank has finished reading
+    };
+
+    std::size_t ranks;
+    std::size_t elements;
+    std::size_t chunkCapacity;
+    std::size_t self = 0;
+    void* region = nullptr;
+    std::size_t regionBytes = 0;
+    Mailbox* mailboxes = nullptr;
+    double* slots = nullptr; // per rank: two slots of chunkCapacity doubles
+    std::uint64_t sent = 0;
+    std::uint64_t received = 0;
+
+    // Chunk boundaries of the range being reduced
+    std::size_t rangeBegin = 0;
+    std::size_t rangeLength = 0;
+
+    [[nodiscard]] std::size_t chunkBegin(std::size_t chunk) const { return rangeBegin + chunk * rangeLength / ranks; }
+    void send(const double* values, std::size_t chunk);
+    // Waits for the next message from the predecessor and hands it to fn(slot, chunk begin, chunk length)
+    template <typename Fn>
+    void receive(std::size_t chunk, Fn&& fn);
+};
+
+#endif //SHAREDMEMORYALLREDUCE_H
@@ -0,0 +1,206 @@
+#include "SharedModel.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#include "NeuralNetwork.h"
+#include "ThreadPool.h"
+#include "UtilityFunctions.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Image layout: header, one entry per layer, then every weight matrix and bias vector as native doubles,
+// each starting on a cache line
+struct SharedImageHeader {
+    char magic[8] = {'N', 'N', 'S', 'H', 'A', 'R', 'E', '1'};
+    std::uint64_t inputSize = 0;
+    std::uint64_t layerCount = 0;
+    std::uint64_t totalBytes = 0;
+};
+
+struct SharedLayerEntry {
+    std::uint64_t rows = 0;
+    std::uint64_t cols = 0;
+    std::uint64_t activation = 0;
+    std::uint64_t weightOffset = 0;
+    std::uint64_t biasOffset = 0;
+};
+
+static constexpr std::size_t SectionAlignment = 64;
+
+static std::size_t alignSection(const std::size_t offset) {
+    return (offset + SectionAlignment - 1) / SectionAlignment * SectionAlignment;
+}
+
+std::string SharedModel::resolve(const std::string& location) {
+    static constexpr std::string_view ShmPrefix = "shm:";
+    if (!location.starts_with(ShmPrefix)) {
+        return location;
+    }
+    const std::string name = location.substr(ShmPrefix.size());
+    if (name.empty() || name.find('/') != std::string::npos) {
+        throw std::invalid_argument("Invalid shared-memory name: " + location);
+    }
+#ifdef __linux__
+    // shm_open() names live in this tmpfs; going through the path gives us rename for atomic publishing
+    return "/dev/shm/" + name;
+#else
+    throw std::runtime_error("Shared-memory segments are only supported on Linux: " + location);
+#endif
+}
+
+void SharedModel::publish(const NeuralNetwork& network, const std::string& location) {
+    const auto& matrices = network.weightsMatrices;
+    if (matrices.empty()) {
+        throw std::invalid_argument("Empty network");
+    }
+    std::vector<SharedLayerEntry> entries(matrices.size());
+    std::size_t offset = sizeof(SharedImageHeader) + entries.size() * sizeof(SharedLayerEntry);
+    for (std::size_t layer = 0; layer < matrices.size(); ++layer) {
+        SharedLayerEntry& entry = entries[layer];
+        entry.rows = matrices[layer].size();
+        entry.cols = matrices[layer][0].size();
+        entry.activation = static_cast<std::uint64_t>(network.layerActivations[layer]);
+        entry.weightOffset = offset = alignSection(offset);
+        offset += entry.rows * entry.cols * sizeof(double);
+        entry.biasOffset = offset = alignSection(offset);
+        offset += entry.rows * sizeof(double);
+    }
+    SharedImageHeader header;
+    header.inputSize = network.inputSize();
+    header.layerCount = entries.size();
+    header.totalBytes = alignSection(offset);
+
+    std::vector<char> image(header.totalBytes, 0);
+    std::memcpy(image.data(), &header, sizeof(header));
+    std::memcpy(image.data() + sizeof(header), entries.data(), entries.size() * sizeof(SharedLayerEntry));
+    for (std::size_t layer = 0; layer < matrices.size(); ++layer) {
+        const SharedLayerEntry& entry = entries[layer];
+        auto* weights = reinterpret_cast<double*>(image.data() + entry.weightOffset);
+        for (std::size_t row = 0; row < entry.rows; ++row) {
+            std::memcpy(weights + row * entry.cols, matrices[layer][row].data(), entry.cols * sizeof(double));
+        }
+        std::memcpy(image.data() + entry.biasOffset, network.biasVectors[layer].data(), entry.rows * sizeof(double));
+    }
+    UtilityFunctions::writeFileAtomic(resolve(location), image.data(), image.size());
+}
+
+void SharedModel::remove(const std::string& location) {
+    // Processes that still map the image keep their pages until they detach
+    std::remove(resolve(location).c_str());
+}
+
+SharedModel::SharedModel(const std::string& location) {
+    const std::string path = resolve(location);
+#ifdef __linux__
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file: " + path);
+    }
+    struct stat info{};
+    if (::fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(SharedImageHeader))) {
+        ::close(fd);
+        throw std::runtime_error("Not a shared model image: " + path);
+    }
+    size = static_cast<std::size_t>(info.st_size);
+    void* address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        throw std::runtime_error("Unable to map file: " + path);
+    }
+    image = static_cast<const char*>(address);
+    mapped = true;
+    // Pages already resident for another worker are simply mapped, the rest are read ahead
+    ::madvise(address, size, MADV_WILLNEED);
+#else
+    fallbackCopy = UtilityFunctions::readFile(path);
+    image = fallbackCopy.data();
+    size = fallbackCopy.size();
+#endif
+
+    try {
+        SharedImageHeader header;
+        static constexpr SharedImageHeader Expected;
+        std::memcpy(&header, image, sizeof(header));
+        if (std::memcmp(header.magic, Expected.magic, sizeof(header.magic)) != 0 || header.totalBytes != size ||
+            header.layerCount == 0 || sizeof(header) + header.layerCount * sizeof(SharedLayerEntry) > size) {
+            throw std::runtime_error("Not a shared model image: " + path);
+        }
+        inputs = header.inputSize;
+        std::size_t previousRows = inputs;
+        for (std::uint64_t layer = 0; layer < header.layerCount; ++layer) {
+            SharedLayerEntry entry;
+            std::memcpy(&entry, image + sizeof(header) + layer * sizeof(entry), sizeof(entry));
+            if (entry.cols != previousRows || entry.activation > static_cast<std::uint64_t>(ActivationType::Identity) ||
+                entry.weightOffset % SectionAlignment != 0 || entry.biasOffset % SectionAlignment != 0 ||
+                entry.weightOffset + entry.rows * entry.cols * sizeof(double) > size ||
+                entry.biasOffset + entry.rows * sizeof(double) > size) {
+                throw std::runtime_error("Inconsistent layer in shared model image: " + path);
+            }
+            Layer& target = layers.emplace_back();
+            target.rows = entry.rows;
+            target.cols = entry.cols;
+            target.kernels = activationKernels(static_cast<ActivationType>(entry.activation));
+            target.weights = reinterpret_cast<const double*>(image + entry.weightOffset);
+            target.biases = reinterpret_cast<const double*>(image + entry.biasOffset);
+            previousRows = entry.rows;
+        }
+    } catch (...) {
+#ifdef __linux__
+        ::munmap(const_cast<char*>(image), size);
+#endif
+        throw;
+    }
+}
+
+SharedModel::SharedModel(SharedModel&& other) noexcept
+    : image(std::exchange(other.image, nullptr)), size(std::exchange(other.size, 0)), mapped(other.mapped),
+      fallbackCopy(std::move(other.fallbackCopy)), inputs(other.inputs), layers(std::move(other.layers)) {
+}
+
+SharedModel::~SharedModel() {
+#ifdef __linux__
+    if (mapped && image != nullptr) {
+        ::munmap(const_cast<char*>(image), size);
+        image = nullptr;
+    }
+#endif
+}
+
+std::vector<double> SharedModel::predict(const std::vector<double>& input) const {
+    if (input.size() != inputs) {
+        throw std::invalid_argument("Input size does not match the shared model.");
+    }
+    // Named references: a thread_local used inside the pool's lambdas would resolve to the worker's copy
+    thread_local std::vector<double> currentBuffer;
+    thread_local std::vector<double> nextBuffer;
+    std::vector<double>& current = currentBuffer;
+    std::vector<double>& next = nextBuffer;
+    current = input;
+    for (std::size_t layer = 0; layer < layers.size(); ++layer) {
+        const Layer& l = layers[layer];
+        next.resize(l.rows);
+        UtilityFunctions::multiplyMatrixVector(l.weights, l.rows, l.cols, current.data(), next.data());
+        for (std::size_t i = 0; i < l.rows; ++i) {
+            next[i] += l.biases[i];
+        }
+        if (layer + 1 != layers.size()) {
+            current.resize(l.rows);
+            ThreadPool::instance().parallelFor(l.rows, l.kernels.flopsPerElement,
+                [&](const std::size_t begin, const std::size_t end) {
+                    l.kernels.forward(next.data() + begin, current.data() + begin, end - begin);
+                });
+        } else {
+            std::swap(current, next);
+        }
+    }
+    return UtilityFunctions::Softmax(current);
+}
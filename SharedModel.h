@@ -0,0 +1,61 @@
+#ifndef SHAREDMODEL_H
+#define SHAREDMODEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Activation.h"
+
+class NeuralNetwork;
+
+// Read-only model whose weights live in one flat, page-aligned image that every process maps with
+// MAP_SHARED. Pre-forked inference workers attached to the same image share its physical pages, so
+// memory per host does not grow with the worker count and new workers start on warm pages.
+//
+// A location is either a file path or "shm:<name>", a segment in the POSIX shared-memory namespace
+// (/dev/shm on Linux). Images are published with an atomic rename, so attaching never sees a partial one,
+// and a republished model does not disturb processes still mapping the previous one. Workers should attach
+// and predict only after fork(), since the shared ThreadPool's threads do not survive it.
+class SharedModel {
+public:
+    // Writes network's inference weights as a shared image at location
+    static void publish(const NeuralNetwork& network, const std::string& location);
+    static void remove(const std::string& location);
+
+    explicit SharedModel(const std::string& location);
+    ~SharedModel();
+
+    SharedModel(SharedModel&& other) noexcept;
+    SharedModel(const SharedModel&) = delete;
+    SharedModel& operator=(const SharedModel&) = delete;
+    SharedModel& operator=(SharedModel&&) = delete;
+
+    // Softmax probabilities, safe to call from any number of threads
+    [[nodiscard]] std::vector<double> predict(const std::vector<double>& input) const;
+
+    [[nodiscard]] std::size_t inputSize() const { return inputs; }
+    [[nodiscard]] std::size_t outputSize() const { return layers.empty() ? 0 : layers.back().rows; }
+    [[nodiscard]] std::size_t mappedBytes() const { return size; }
+
+private:
+    struct Layer {
+        std::size_t rows = 0;
+        std::size_t cols = 0;
+        ActivationKernels kernels;
+        const double* weights = nullptr; // row-major rows x cols inside the mapping
+        const double* biases = nullptr;
+    };
+
+    const char* image = nullptr;
+    std::size_t size = 0;
+    bool mapped = false;            // false: a private heap copy where mmap is unavailable
+    std::vector<char> fallbackCopy;
+    std::size_t inputs = 0;
+    std::vector<Layer> layers;
+
+    static std::string resolve(const std::string& location);
+};
+
+#endif //SHAREDMODEL_H
@@ -0,0 +1,185 @@
+#include "SystemTopology.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static bool readFirstLine(const std::string& path, std::string& line) {
+    std::ifstream file(path);
+    return file.is_open() && std::getline(file, line);
+}
+
+std::vector<int> SystemTopology::parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::istringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        const auto dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+#ifdef __linux__
+// cgroup v2 cpu.max ("max 100000" or "<quota> <period>") for this process, then the v1 CFS files
+static double readCgroupQuota() {
+    std::string cgroupPath = "/";
+    std::ifstream self("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(self, line)) {
+        if (line.rfind("0::", 0) == 0) {
+            cgroupPath = line.substr(3);
+        }
+    }
+
+    for (const std::string& path : {"/sys/fs/cgroup" + cgroupPath + "/cpu.max", std::string("/sys/fs/cgroup/cpu.max")}) {
+        if (readFirstLine(path, line)) {
+            std::istringstream fields(line);
+            std::string quota;
+            double period = 0.0;
+            fields >> quota >> period;
+            if (quota == "max" || period <= 0.0) {
+                return 0.0;
+            }
+            return std::stod(quota) / period;
+        }
+    }
+
+    std::string quota;
+    std::string period;
+    for (const std::string dir : {"/sys/fs/cgroup/cpu/", "/sys/fs/cgroup/cpu,cpuacct/"}) {
+        if (readFirstLine(dir + "cpu.cfs_quota_us", quota) && readFirstLine(dir + "cpu.cfs_period_us", period)) {
+            const double quotaUs = std::stod(quota);
+            const double periodUs = std::stod(period);
+            return quotaUs > 0.0 && periodUs > 0.0 ? quotaUs / periodUs : 0.0;
+        }
+    }
+    return 0.0;
+}
+#endif
+
+SystemTopology SystemTopology::detect() {
+    SystemTopology topology;
+#ifdef __linux__
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &mask)) {
+                topology.cpus.push_back(cpu);
+            }
+        }
+    }
+
+    // NUMA node of every CPU from sysfs, machines without the node directory are a single node
+    std::vector<int> nodeOfCpu;
+    std::string line;
+    for (int node = 0; readFirstLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", line); ++node) {
+        for (const int cpu : parseCpuList(line)) {
+            if (cpu >= static_cast<int>(nodeOfCpu.size())) {
+                nodeOfCpu.resize(cpu + 1, 0);
+            }
+            nodeOfCpu[cpu] = node;
+        }
+        topology.numaNodes = node + 1;
+    }
+    std::ranges::stable_sort(topology.cpus, [&](const int a, const int b) {
+        const int nodeA = a < static_cast<int>(nodeOfCpu.size()) ? nodeOfCpu[a] : 0;
+        const int nodeB = b < static_cast<int>(nodeOfCpu.size()) ? nodeOfCpu[b] : 0;
+        return nodeA < nodeB;
+    });
+    for (const int cpu : topology.cpus) {
+        topology.cpuNodes.push_back(cpu < static_cast<int>(nodeOfCpu.size()) ? nodeOfCpu[cpu] : 0);
+    }
+
+    topology.cpuQuota = readCgroupQuota();
+
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    while (topology.cpuModel.empty() && std::getline(cpuinfo, line)) {
+        // x86 "model name", some ARM kernels only report "Processor" or "CPU part"
+        for (const std::string key : {"model name", "Processor", "CPU part"}) {
+            const auto colon = line.find(':');
+            if (line.rfind(key, 0) == 0 && colon != std::string::npos && colon + 2 <= line.size()) {
+                topology.cpuModel = line.substr(colon + 2);
+                break;
+            }
+        }
+    }
+#endif
+    if (topology.cpuModel.empty()) {
+        topology.cpuModel = "unknown";
+    }
+    if (topology.cpus.empty()) {
+        const unsigned count = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned cpu = 0; cpu < count; ++cpu) {
+            topology.cpus.push_back(static_cast<int>(cpu));
+            topology.cpuNodes.push_back(0);
+        }
+    }
+    return topology;
+}
+
+std::size_t SystemTopology::recommendedThreads() const {
+    std::size_t threads = std::max<std::size_t>(1, cpus.size());
+    if (cpuQuota > 0.0) {
+        threads = std::min(threads, static_cast<std::size_t>(std::ceil(cpuQuota)));
+    }
+    return std::max<std::size_t>(1, threads);
+}
+
+bool SystemTopology::restrictCurrentThread(const std::vector<int>& cpus) {
+#ifdef __linux__
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (const int cpu : cpus) {
+        CPU_SET(cpu, &mask);
+    }
+    return !cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+#else
+    (void) cpus;
+    return false;
+#endif
+}
+
+bool SystemTopology::releasePages(void* data, const std::size_t bytes) {
+#ifdef __linux__
+    static const auto pageSize = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+    const auto begin = (reinterpret_cast<std::uintptr_t>(data) + pageSize - 1) / pageSize * pageSize;
+    const auto end = (reinterpret_cast<std::uintptr_t>(data) + bytes) / pageSize * pageSize;
+    // Private anonymous pages read back as zeros after MADV_DONTNEED, and are allocated again on first touch
+    return begin >= end || ::madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED) == 0;
+#else
+    (void) data;
+    (void) bytes;
+    return false;
+#endif
+}
+
+bool SystemTopology::pinCurrentThread(const int cpu) {
+#ifdef __linux__
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+#else
+    (void) cpu;
+    return false;
+#endif
+}
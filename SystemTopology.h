@@ -0,0 +1,34 @@
+#ifndef SYSTEMTOPOLOGY_H
+#define SYSTEMTOPOLOGY_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// CPUs this process may run on, their NUMA nodes and the container CPU quota
+struct SystemTopology {
+    std::vector<int> cpus;      // allowed CPUs ordered by NUMA node, so neighbouring workers share a node
+    std::vector<int> cpuNodes;  // NUMA node of cpus[i]
+    std::size_t numaNodes = 1;
+    double cpuQuota = 0.0;      // CPUs granted by the cgroup quota, 0 when unlimited
+    std::string cpuModel;       // processor name as the OS reports it, "unknown" where it does not
+
+    static SystemTopology detect();
+
+    // Threads worth running: the affinity mask capped by the cgroup quota (rounded up)
+    [[nodiscard]] std::size_t recommendedThreads() const;
+
+    // Pins the calling thread to a single CPU, returns false if the platform refuses
+    static bool pinCurrentThread(int cpu);
+    // Limits the calling thread, and the threads it creates afterwards, to cpus
+    static bool restrictCurrentThread(const std::vector<int>& cpus);
+
+    // Gives back the whole pages inside [data, data + bytes), which must hold only zeros, so the next write
+    // allocates them on the writing thread's NUMA node. Returns false where this is not supported.
+    static bool releasePages(void* data, std::size_t bytes);
+
+    // Parses a kernel CPU list such as "0-3,8,10-11"
+    static std::vector<int> parseCpuList(const std::string& list);
+};
+
+#endif //SYSTEMTOPOLOGY_H
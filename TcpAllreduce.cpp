@@ -0,0 +1,346 @@
+#include "TcpAllreduce.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+TcpAllreduceConfig TcpAllreduceConfig::fromEnvironment() {
+    TcpAllreduceConfig config;
+    if (const char* peers = std::getenv("NN_PEERS"); peers != nullptr) {
+        std::string_view list = peers;
+        while (!list.empty()) {
+            const std::size_t comma = list.find(',');
+            if (const std::string_view peer = list.substr(0, comma); !peer.empty()) {
+                config.peers.emplace_back(peer);
+            }
+            list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+        }
+    }
+    if (const char* rank = std::getenv("NN_RANK"); rank != nullptr && *rank != '\0') {
+        config.rank = std::stoul(rank);
+    }
+    if (const char* bytes = std::getenv("NN_BUCKET_BYTES"); bytes != nullptr && *bytes != '\0') {
+        config.bucketBytes = std::stoul(bytes);
+    }
+    return config;
+}
+
+TcpAllreduce::TcpAllreduce(const TcpAllreduceConfig& config, const std::size_t count)
+    : self(config.rank), ranks(config.peers.size()), elements(count),
+      bucketLength(std::max<std::size_t>(1, config.bucketBytes / sizeof(double))) {
+    if (ranks == 0 || self >= ranks) {
+        throw std::invalid_argument("Rank " + std::to_string(self) + " is not in the peer list.");
+    }
+    incoming.resize((count + ranks - 1) / ranks);
+    if (ranks > 1) {
+        connectRing(config);
+    }
+    progress = std::thread(&TcpAllreduce::run, this);
+}
+
+TcpAllreduce::~TcpAllreduce() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    progress.join();
+    closeSockets();
+}
+
+void TcpAllreduce::submit(double* values, const std::size_t begin, const std::size_t end) {
+    if (begin > end || end > elements) {
+        throw std::out_of_range("Allreduce range out of bounds.");
+    }
+    {
+        std::lock_guard lock(mutex);
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+        pending.push_back({values, begin, end});
+    }
+    changed.notify_all();
+}
+
+void TcpAllreduce::wait() {
+    std::unique_lock lock(mutex);
+    changed.wait(lock, [&] { return pending.empty() || failure; });
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+void TcpAllreduce::run() {
+    while (true) {
+        Bucket bucket{};
+        {
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [&] { return stopping || !pending.empty(); });
+            if (pending.empty()) {
+                return;
+            }
+            bucket = pending.front();
+        }
+        try {
+            reduce(bucket);
+        } catch (...) {
+            std::lock_guard lock(mutex);
+            // The ring is out of step now, later buckets cannot be reduced either
+            failure = std::current_exception();
+            pending.clear();
+            changed.notify_all();
+            return;
+        }
+        {
+            std::lock_guard lock(mutex);
+            pending.pop_front();
+        }
+        changed.notify_all();
+    }
+}
+
+void TcpAllreduce::reduce(const Bucket& bucket) {
+    if (ranks == 1) {
+        return;
+    }
+    const std::size_t length = bucket.end - bucket.begin;
+    double* values = bucket.values;
+    const auto chunkBegin = [&](const std::size_t chunk) { return bucket.begin + chunk * length / ranks; };
+    const auto chunkLength = [&](const std::size_t chunk) { return chunkBegin(chunk + 1) - chunkBegin(chunk); };
+
+    // Reduce-scatter: after ranks - 1 steps this rank holds the full sum of chunk (self + 1) % ranks
+    for (std::size_t step = 0; step + 1 < ranks; ++step) {
+        const std::size_t sendChunk = (self + ranks - step) % ranks;
+        const std::size_t receiveChunk = (self + 2 * ranks - step - 1) % ranks;
+        exchange(values + chunkBegin(sendChunk), chunkLength(sendChunk), incoming.data(), chunkLength(receiveChunk));
+        double* target = values + chunkBegin(receiveChunk);
+        for (std::size_t i = 0; i < chunkLength(receiveChunk); ++i) {
+            target[i] += incoming[i];
+        }
+    }
+    const std::size_t owned = (self + 1) % ranks;
+    const double scale = 1.0 / static_cast<double>(ranks);
+    for (std::size_t i = chunkBegin(owned); i < chunkBegin(owned + 1); ++i) {
+        values[i] *= scale;
+    }
+    // Allgather: the chunk received is never the one being sent, so it lands in place
+    for (std::size_t step = 0; step + 1 < ranks; ++step) {
+        const std::size_t sendChunk = (self + 1 + ranks - step) % ranks;
+        const std::size_t receiveChunk = (self + ranks - step) % ranks;
+        exchange(values + chunkBegin(sendChunk), chunkLength(sendChunk), values + chunkBegin(receiveChunk),
+                 chunkLength(receiveChunk));
+    }
+}
+
+#ifdef __linux__
+
+static std::pair<std::string, std::string> splitAddress(const std::string& peer) {
+    const std::size_t colon = peer.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == peer.size()) {
+        throw std::invalid_argument("Peer address must be host:port: " + peer);
+    }
+    return {peer.substr(0, colon), peer.substr(colon + 1)};
+}
+
+static addrinfo* resolveAddress(const char* host, const std::string& port, const int flags) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = flags;
+    addrinfo* result = nullptr;
+    if (const int error = ::getaddrinfo(host, port.c_str(), &hints, &result); error != 0) {
+        throw std::runtime_error("Unable to resolve " + std::string(host != nullptr ? host : "*") + ":" + port + ": " +
+                                 ::gai_strerror(error));
+    }
+    return result;
+}
+
+static void sendAll(const int socket, const void* data, std::size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t written = ::send(socket, bytes, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            throw std::runtime_error("Lost connection to an allreduce peer.");
+        }
+        bytes += written;
+        size -= static_cast<std::size_t>(written);
+    }
+}
+
+static void receiveAll(const int socket, void* data, std::size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        const ssize_t read = ::recv(socket, bytes, size, 0);
+        if (read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read <= 0) {
+            throw std::runtime_error("Lost connection to an allreduce peer.");
+        }
+        bytes += read;
+        size -= static_cast<std::size_t>(read);
+    }
+}
+
+// Small messages must not wait for Nagle, and the progress loop polls instead of blocking
+static void tuneSocket(const int socket) {
+    constexpr int enabled = 1;
+    ::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+    ::fcntl(socket, F_SETFL, ::fcntl(socket, F_GETFL) | O_NONBLOCK);
+}
+
+void TcpAllreduce::connectRing(const TcpAllreduceConfig& config) {
+    // Listen first: connects to a listening socket complete from the backlog before anyone accepts,
+    // so the ring forms whatever order the nodes start in
+    const auto [ownHost, ownPort] = splitAddress(config.peers[self]);
+    addrinfo* local = resolveAddress(nullptr, ownPort, AI_PASSIVE);
+    int listener = -1;
+    for (const addrinfo* address = local; address != nullptr && listener < 0; address = address->ai_next) {
+        listener = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (listener < 0) {
+            continue;
+        }
+        constexpr int enabled = 1;
+        ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+        if (::bind(listener, address->ai_addr, address->ai_addrlen) != 0 || ::listen(listener, 4) != 0) {
+            ::close(listener);
+            listener = -1;
+        }
+    }
+    ::freeaddrinfo(local);
+    if (listener < 0) {
+        throw std::runtime_error("Unable to listen on port " + ownPort);
+    }
+
+    try {
+        const auto [nextHost, nextPort] = splitAddress(config.peers[(self + 1) % ranks]);
+        const auto deadline = std::chrono::steady_clock::now() +
+                              std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  std::chrono::duration<double>(config.connectTimeoutSeconds));
+        while (nextSocket < 0) {
+            addrinfo* remote = resolveAddress(nextHost.c_str(), nextPort, 0);
+            for (const addrinfo* address = remote; address != nullptr && nextSocket < 0; address = address->ai_next) {
+                nextSocket = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+                if (nextSocket >= 0 && ::connect(nextSocket, address->ai_addr, address->ai_addrlen) != 0) {
+                    ::close(nextSocket);
+                    nextSocket = -1;
+                }
+            }
+            ::freeaddrinfo(remote);
+            if (nextSocket < 0) {
+                // The successor may simply not be up yet
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    throw std::runtime_error("Unable to connect to " + config.peers[(self + 1) % ranks]);
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+        }
+        // Ranks that disagree on the vector or bucket size would cut different ranges and desynchronize the ring
+        const std::uint64_t hello[3] = {self, elements, bucketLength};
+        sendAll(nextSocket, hello, sizeof(hello));
+
+        pollfd waiting{listener, POLLIN, 0};
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (::poll(&waiting, 1, static_cast<int>(std::max<std::int64_t>(0, remaining.count()))) <= 0) {
+            throw std::runtime_error("No connection from rank " + std::to_string((self + ranks - 1) % ranks));
+        }
+        previousSocket = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (previousSocket < 0) {
+            throw std::runtime_error("Unable to accept the ring connection on port " + ownPort);
+        }
+        std::uint64_t peer[3] = {};
+        receiveAll(previousSocket, peer, sizeof(peer));
+        if (peer[0] != (self + ranks - 1) % ranks) {
+            throw std::runtime_error("Unexpected allreduce peer " + std::to_string(peer[0]) + ", check the peer list order.");
+        }
+        if (peer[1] != elements || peer[2] != bucketLength) {
+            throw std::runtime_error("Rank " + std::to_string(peer[0]) + " uses a different model or bucket size.");
+        }
+    } catch (...) {
+        ::close(listener);
+        closeSockets();
+        throw;
+    }
+    ::close(listener);
+    tuneSocket(nextSocket);
+    tuneSocket(previousSocket);
+}
+
+void TcpAllreduce::exchange(const double* send, const std::size_t sendCount, double* receive,
+                            const std::size_t receiveCount) {
+    const char* sendBytes = reinterpret_cast<const char*>(send);
+    char* receiveBytes = reinterpret_cast<char*>(receive);
+    std::size_t toSend = sendCount * sizeof(double);
+    std::size_t toReceive = receiveCount * sizeof(double);
+    while (toSend > 0 || toReceive > 0) {
+        pollfd sockets[2] = {{nextSocket, static_cast<short>(toSend > 0 ? POLLOUT : 0), 0},
+                             {previousSocket, static_cast<short>(toReceive > 0 ? POLLIN : 0), 0}};
+        if (::poll(sockets, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Polling the allreduce sockets failed.");
+        }
+        if (toSend > 0 && sockets[0].revents != 0) {
+            const ssize_t written = ::send(nextSocket, sendBytes, toSend, MSG_NOSIGNAL);
+            if (written < 0 && errno != EAGAIN && errno != EINTR) {
+                throw std::runtime_error("Lost connection to rank " + std::to_string((self + 1) % ranks));
+            }
+            if (written > 0) {
+                sendBytes += written;
+                toSend -= static_cast<std::size_t>(written);
+            }
+        }
+        if (toReceive > 0 && sockets[1].revents != 0) {
+            const ssize_t read = ::recv(previousSocket, receiveBytes, toReceive, 0);
+            if (read == 0 || (read < 0 && errno != EAGAIN && errno != EINTR)) {
+                throw std::runtime_error("Lost connection to rank " + std::to_string((self + ranks - 1) % ranks));
+            }
+            if (read > 0) {
+                receiveBytes += read;
+                toReceive -= static_cast<std::size_t>(read);
+            }
+        }
+    }
+}
+
+void TcpAllreduce::closeSockets() {
+    for (int* socket : {&nextSocket, &previousSocket}) {
+        if (*socket >= 0) {
+            ::close(*socket);
+            *socket = -1;
+        }
+    }
+}
+
+#else
+
+void TcpAllreduce::connectRing(const TcpAllreduceConfig&) {
+    throw std::runtime_error("Multi-node training is only supported on Linux.");
+}
+
+void TcpAllreduce::exchange(const double*, std::size_t, double*, std::size_t) {
+}
+
+void TcpAllreduce::closeSockets() {
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef TCPALLREDUCE_H
+#define TCPALLREDUCE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "GradientAllreduce.h"
+
+struct TcpAllreduceConfig {
+    std::vector<std::string> peers;  // "host:port" of every rank in ring order, this rank listens on its own port
+    std::size_t rank = 0;
+    std::size_t bucketBytes = 1 << 20; // gradient bytes gathered before a bucket is sent
+    double connectTimeoutSeconds = 60.0;
+
+    // NN_PEERS (comma-separated host:port list), NN_RANK and NN_BUCKET_BYTES
+    static TcpAllreduceConfig fromEnvironment();
+};
+
+// Ring allreduce between machines. Each rank keeps one TCP connection to its successor and one from its
+// predecessor; a progress thread works through the submitted buckets in order, running a reduce-scatter and
+// an allgather over the ring for each, so the network is busy while the trainer is still in backPropagate.
+// Doubles travel in native byte order, so every node must share the same architecture.
+class TcpAllreduce : public GradientAllreduce {
+public:
+    // Connects the ring, blocking until every neighbour is reachable or the timeout expires
+    TcpAllreduce(const TcpAllreduceConfig& config, std::size_t count);
+    ~TcpAllreduce() override;
+
+    TcpAllreduce(const TcpAllreduce&) = delete;
+    TcpAllreduce& operator=(const TcpAllreduce&) = delete;
+
+    [[nodiscard]] std::size_t rank() const override { return self; }
+    [[nodiscard]] std::size_t size() const override { return ranks; }
+    [[nodiscard]] std::size_t count() const override { return elements; }
+    [[nodiscard]] std::size_t bucketElements() const override { return bucketLength; }
+
+    void submit(double* values, std::size_t begin, std::size_t end) override;
+    void wait() override;
+
+private:
+    struct Bucket {
+        double* values;
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    std::size_t self;
+    std::size_t ranks;
+    std::size_t elements;
+    std::size_t bucketLength;
+    int nextSocket = -1;     // to rank + 1
+    int previousSocket = -1; // from rank - 1
+    std::vector<double> incoming;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Bucket> pending; // the front one is in progress
+    std::exception_ptr failure;
+    bool stopping = false;
+    std::thread progress;
+
+    void connectRing(const TcpAllreduceConfig& config);
+    void run();
+    void reduce(const Bucket& bucket);
+    // Sends and receives at the same time, so a ring of blocking sends can never deadlock on full buffers
+    void exchange(const double* send, std::size_t sendCount, double* receive, std::size_t receiveCount);
+    void closeSockets();
+};
+
+#endif //TCPALLREDUCE_H
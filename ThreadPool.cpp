@@ -0,0 +1,283 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+namespace {
+    // Index of the pool worker running on this thread, or -1 for threads outside the pool
+    thread_local long long currentWorker = -1;
+    thread_local const void* currentPool = nullptr;
+
+    std::mutex configMutex;
+    std::optional<ThreadPoolConfig> configuredPool;
+    bool poolCreated = false;
+    std::unique_ptr<ThreadPool> sharedPoolOwner;
+    std::atomic<ThreadPool*> sharedPool{nullptr};
+
+    bool environmentFlag(const char* name, const bool fallback) {
+        const char* value = std::getenv(name);
+        if (value == nullptr || *value == '\0') {
+            return fallback;
+        }
+        return std::string(value) != "0";
+    }
+}
+
+ThreadPoolConfig ThreadPoolConfig::fromEnvironment() {
+    ThreadPoolConfig config;
+    if (const char* threads = std::getenv("NN_THREADS"); threads != nullptr && *threads != '\0') {
+        config.threads = std::stoul(threads);
+    }
+    config.pinThreads = environmentFlag("NN_PIN_THREADS", config.pinThreads);
+    config.numaAware = environmentFlag("NN_NUMA_AWARE", config.numaAware);
+    return config;
+}
+
+ThreadPool::ThreadPool(const std::size_t threads) : ThreadPool(ThreadPoolConfig{threads, false, false}) {
+}
+
+ThreadPool::ThreadPool(const ThreadPoolConfig& config) : config(config), systemTopology(SystemTopology::detect()) {
+    const std::size_t threads = config.threads > 0 ? config.threads : systemTopology.recommendedThreads();
+    const std::size_t workerCount = threads > 1 ? threads - 1 : 0; // the caller is the last participant
+    workers.reserve(workerCount);
+    for (std::size_t i = 0; i < workerCount; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (std::size_t i = 0; i < workerCount; ++i) {
+        workers[i]->thread = std::thread(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (const auto& worker : workers) {
+        worker->thread.join();
+    }
+}
+
+ThreadPool& ThreadPool::instance() {
+    if (ThreadPool* pool = sharedPool.load(std::memory_order_acquire)) {
+        return *pool;
+    }
+    std::lock_guard lock(configMutex);
+    if (!sharedPoolOwner) {
+        poolCreated = true;
+        sharedPoolOwner = std::make_unique<ThreadPool>(configuredPool.value_or(ThreadPoolConfig::fromEnvironment()));
+        sharedPool.store(sharedPoolOwner.get(), std::memory_order_release);
+    }
+    return *sharedPoolOwner;
+}
+
+void ThreadPool::reinitializeAfterFork() {
+    // The workers did not survive the fork, so the old pool can neither run tasks nor be joined: leak it
+    static_cast<void>(sharedPoolOwner.release());
+    sharedPool.store(nullptr, std::memory_order_release);
+    poolCreated = false;
+    configuredPool.reset();
+}
+
+void ThreadPool::configure(const ThreadPoolConfig& config) {
+    std::lock_guard lock(configMutex);
+    if (poolCreated) {
+        throw std::logic_error("ThreadPool::configure must be called before the pool is first used.");
+    }
+    configuredPool = config;
+}
+
+bool ThreadPool::pinCallingThread() const {
+    if (!config.pinThreads) {
+        return false;
+    }
+    return SystemTopology::pinCurrentThread(systemTopology.cpus[workers.size() % systemTopology.cpus.size()]);
+}
+
+bool ThreadPool::insideThisPool() const {
+    return currentPool == this && currentWorker >= 0;
+}
+
+std::size_t ThreadPool::grainSize(const std::size_t count, const double totalFlops) const {
+    // Enough tasks for stealing to balance the load, but none smaller than TaskFlopTarget
+    const auto byWork = static_cast<std::size_t>(std::max(1.0, totalFlops / TaskFlopTarget));
+    const std::size_t tasks = std::clamp<std::size_t>(byWork, 1, size() * 4);
+    return (count + tasks - 1) / tasks;
+}
+
+void ThreadPool::push(const std::size_t queue, const Task& task) {
+    Worker& worker = *workers[queue];
+    std::lock_guard lock(worker.mutex);
+    worker.tasks.push_back(task);
+}
+
+bool ThreadPool::tryTake(const std::size_t self, Task& task) {
+    const std::size_t count = workers.size();
+    if (self < count) {
+        Worker& own = *workers[self];
+        std::lock_guard lock(own.mutex);
+        if (!own.pinned.empty()) {
+            task = own.pinned.front();
+            own.pinned.pop_front();
+            queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    const std::size_t start = self < count ? self + 1 : 0;
+    for (std::size_t offset = 0; offset < count; ++offset) {
+        Worker& victim = *workers[(start + offset) % count];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::execute(const Task& task) {
+    Job& job = *task.job;
+    try {
+        (*job.body)(task.begin, task.end);
+    } catch (...) {
+        std::lock_guard lock(job.errorMutex);
+        if (!job.error) {
+            job.error = std::current_exception();
+        }
+    }
+    job.pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void ThreadPool::run(const std::size_t count, const std::size_t grain,
+                     const std::function<void(std::size_t, std::size_t)>& body) {
+    Job job;
+    job.body = &body;
+    const std::size_t tasks = (count + grain - 1) / grain;
+    job.pending.store(tasks, std::memory_order_relaxed);
+
+    const bool insidePool = insideThisPool();
+    const std::size_t self = insidePool ? static_cast<std::size_t>(currentWorker) : workers.size();
+
+    // Keep the first chunk for the calling thread, spread the rest over the deques
+    queuedTasks.fetch_add(tasks - 1, std::memory_order_release);
+    for (std::size_t t = 1; t < tasks; ++t) {
+        const std::size_t queue = insidePool ? self : nextQueue.fetch_add(1, std::memory_order_relaxed) % workers.size();
+        push(queue, Task{&job, t * grain, std::min(count, (t + 1) * grain)});
+    }
+    {
+        std::lock_guard lock(sleepMutex);
+    }
+    wakeUp.notify_all();
+
+    execute(Task{&job, 0, std::min(count, grain)});
+    wait(job, self);
+}
+
+void ThreadPool::runStatic(const std::size_t count, const std::function<void(std::size_t, std::size_t)>& body) {
+    Job job;
+    job.body = &body;
+    const std::size_t participants = size();
+    job.pending.store(participants, std::memory_order_relaxed);
+
+    queuedTasks.fetch_add(workers.size(), std::memory_order_release);
+    for (std::size_t p = 0; p < workers.size(); ++p) {
+        Worker& worker = *workers[p];
+        std::lock_guard lock(worker.mutex);
+        const Task slice{&job, count * p / participants, count * (p + 1) / participants};
+        // A worker busy with a posted function would only get to its slice once that returns
+        (worker.inPosted ? worker.tasks : worker.pinned).push_back(slice);
+    }
+    {
+        std::lock_guard lock(sleepMutex);
+    }
+    wakeUp.notify_all();
+
+    // The calling thread is the last participant
+    execute(Task{&job, count * workers.size() / participants, count});
+    wait(job, workers.size());
+}
+
+void ThreadPool::post(std::function<void()> fn) {
+    if (workers.empty()) {
+        fn();
+        return;
+    }
+    {
+        std::lock_guard lock(sleepMutex);
+        posted.push_back(std::move(fn));
+    }
+    wakeUp.notify_one();
+}
+
+void ThreadPool::wait(Job& job, const std::size_t self) {
+    // Help with whatever is queued until this job is finished
+    Task task;
+    while (job.pending.load(std::memory_order_acquire) != 0) {
+        if (tryTake(self, task)) {
+            execute(task);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    if (job.error) {
+        std::rethrow_exception(job.error);
+    }
+}
+
+void ThreadPool::setInPosted(const std::size_t index, const bool running) {
+    Worker& worker = *workers[index];
+    std::lock_guard lock(worker.mutex);
+    worker.inPosted = running;
+    // Static slices pinned since this worker last looked are handed to the thieves
+    if (running) {
+        worker.tasks.insert(worker.tasks.end(), worker.pinned.begin(), worker.pinned.end());
+        worker.pinned.clear();
+    }
+}
+
+void ThreadPool::workerLoop(const std::size_t index) {
+    currentWorker = static_cast<long long>(index);
+    currentPool = this;
+    if (config.pinThreads) {
+        SystemTopology::pinCurrentThread(systemTopology.cpus[index % systemTopology.cpus.size()]);
+    }
+    Task task;
+    while (true) {
+        if (tryTake(index, task)) {
+            execute(task);
+            continue;
+        }
+        std::unique_lock lock(sleepMutex);
+        // Posted functions only start on idle workers, never on a thread helping in wait(), so a long
+        // one cannot hold up the parallel loop that thread is part of
+        if (!posted.empty()) {
+            const std::function<void()> fn = std::move(posted.front());
+            posted.pop_front();
+            lock.unlock();
+            setInPosted(index, true);
+            fn();
+            setInPosted(index, false);
+            continue;
+        }
+        wakeUp.wait(lock, [this] {
+            return stopping || queuedTasks.load(std::memory_order_acquire) > 0 || !posted.empty();
+        });
+        if (stopping && posted.empty()) {
+            return;
+        }
+    }
+}
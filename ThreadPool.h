@@ -0,0 +1,164 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "SystemTopology.h"
+
+struct ThreadPoolConfig {
+    std::size_t threads = 0;  // 0: derived from the affinity mask and the cgroup CPU quota
+    bool pinThreads = false;  // pin every worker to its own CPU, grouped by NUMA node, see pinCallingThread()
+    bool numaAware = false;   // split top-level loops statically so each thread keeps touching the pages it allocated
+
+    // NN_THREADS, NN_PIN_THREADS and NN_NUMA_AWARE override the defaults
+    static ThreadPoolConfig fromEnvironment();
+};
+
+// Work-stealing pool shared by every kernel. Each worker owns a deque: it pops its own tasks LIFO and
+// steals from the others FIFO. A thread waiting on a parallelFor runs pending tasks instead of blocking,
+// so nested parallelFor calls never deadlock.
+class ThreadPool {
+public:
+    // Total work (in FLOPs) below which a parallelFor runs inline on the calling thread
+    static constexpr double SerialFlopThreshold = 50000.0;
+    // Target work per task, bigger tasks amortize the scheduling cost
+    static constexpr double TaskFlopTarget = 25000.0;
+
+    explicit ThreadPool(std::size_t threads);
+    explicit ThreadPool(const ThreadPoolConfig& config);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // The shared pool, created on first use from configure() or ThreadPoolConfig::fromEnvironment()
+    static ThreadPool& instance();
+    // Must be called before the first instance() call
+    static void configure(const ThreadPoolConfig& config);
+    // In a child of fork(): forgets the parent's pool, whose threads only exist in the parent, so the next
+    // instance() starts fresh workers (configure() may be called again first). Call before any other thread exists.
+    static void reinitializeAfterFork();
+
+    [[nodiscard]] const SystemTopology& topology() const { return systemTopology; }
+
+    // With pinThreads, pins the calling thread to the CPU the workers leave for the last participant. Call it
+    // from the thread that drives the parallel loops, e.g. in main; threads it starts afterwards inherit that
+    // CPU. Returns false when pinning is off or the platform refuses.
+    bool pinCallingThread() const;
+
+    // Threads taking part in a parallelFor, the calling thread included
+    [[nodiscard]] std::size_t size() const { return workers.size() + 1; }
+
+    // Calls fn(begin, end) over disjoint ranges covering [0, count). flopsPerItem sizes the chunks,
+    // small operations run serially without touching the pool.
+    template <typename Fn>
+    void parallelFor(const std::size_t count, const double flopsPerItem, Fn&& fn) {
+        const double totalFlops = static_cast<double>(count) * flopsPerItem;
+        if (count == 0) {
+            return;
+        }
+        if (workers.empty() || count == 1 || totalFlops < SerialFlopThreshold) {
+            fn(std::size_t{0}, count);
+            return;
+        }
+        const std::function<void(std::size_t, std::size_t)> body = std::forward<Fn>(fn);
+        if (config.numaAware && !insideThisPool()) {
+            runStatic(count, body);
+        } else {
+            run(count, grainSize(count, totalFlops), body);
+        }
+    }
+
+    // parallelFor with an explicit chunk size instead of the FLOP heuristic, e.g. one picked by benchmarking.
+    // grain >= count runs inline on the calling thread.
+    template <typename Fn>
+    void parallelForGrain(const std::size_t count, const std::size_t grain, Fn&& fn) {
+        if (count == 0) {
+            return;
+        }
+        if (workers.empty() || grain == 0 || grain >= count) {
+            fn(std::size_t{0}, count);
+            return;
+        }
+        const std::function<void(std::size_t, std::size_t)> body = std::forward<Fn>(fn);
+        run(count, grain, body);
+    }
+
+    // Runs fn once on whichever worker goes idle first, without waiting for it. Parallel loops are always
+    // served before posted functions. Without workers fn runs inline before post returns. fn must not throw.
+    void post(std::function<void()> fn);
+
+    // Participant p gets the p-th contiguous slice of [0, count). Used to first-touch allocate
+    // weight shards on the thread (and NUMA node) that later processes them. Nested calls fall back to stealing,
+    // and so does the slice of a worker busy with a posted function, so the loop never waits for that function.
+    template <typename Fn>
+    void parallelForStatic(const std::size_t count, Fn&& fn) {
+        if (count == 0) {
+            return;
+        }
+        if (workers.empty() || count == 1) {
+            fn(std::size_t{0}, count);
+            return;
+        }
+        const std::function<void(std::size_t, std::size_t)> body = std::forward<Fn>(fn);
+        if (insideThisPool()) {
+            run(count, (count + size() - 1) / size(), body);
+        } else {
+            runStatic(count, body);
+        }
+    }
+
+private:
+    struct Job {
+        const std::function<void(std::size_t, std::size_t)>* body = nullptr;
+        std::atomic<std::size_t> pending{0};
+        std::mutex errorMutex;
+        std::exception_ptr error;
+    };
+
+    struct Task {
+        Job* job = nullptr;
+        std::size_t begin = 0;
+        std::size_t end = 0;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::deque<Task> pinned; // static slices only this worker may run
+        bool inPosted = false;   // running a posted function, its static slices go to tasks for others to steal
+        std::thread thread;
+    };
+
+    ThreadPoolConfig config;
+    SystemTopology systemTopology;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::atomic<std::size_t> queuedTasks{0};
+    std::atomic<std::size_t> nextQueue{0};
+    std::deque<std::function<void()>> posted; // guarded by sleepMutex
+    bool stopping = false;
+
+    [[nodiscard]] std::size_t grainSize(std::size_t count, double totalFlops) const;
+    [[nodiscard]] bool insideThisPool() const;
+    void run(std::size_t count, std::size_t grain, const std::function<void(std::size_t, std::size_t)>& body);
+    void runStatic(std::size_t count, const std::function<void(std::size_t, std::size_t)>& body);
+    void wait(Job& job, std::size_t self);
+    void push(std::size_t queue, const Task& task);
+    bool tryTake(std::size_t self, Task& task);
+    static void execute(const Task& task);
+    void setInPosted(std::size_t index, bool running);
+    void workerLoop(std::size_t index);
+};
+
+#endif //THREADPOOL_H
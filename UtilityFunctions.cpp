@@ -4,8 +4,20 @@
 #include <random>
 #include <iostream>
 #include <sstream>
-#include <execution>
 #include <fstream>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <numeric>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "ActivationMath.h"
+#include "ThreadPool.h"
+#include "VectorExpression.h"
 
 std::vector<double> UtilityFunctions::multiplyMatrixVector(
     const std::vector<std::vector<double>> &matrix,
@@ -26,43 +38,45 @@ std::vector<double> UtilityFunctions::multiplyMatrixVector(
     }
 
     // Matrix-vector multiplication
-    const std::vector<double>::size_type rows(matrix.size());
-    std::vector result(rows, 0.0);
-
-    // Use std::transform with a parallel execution policy
-    std::transform(std::execution::par,
-        matrix.begin(), matrix.end(), result.begin(),
-                   [&vec] // <- using
-                   // in Lambda function
-                   (const std::vector<double>& row) {
-                       double sum = 0.0;
-                       for (std::size_t j = 0; j < vec.size(); ++j) {
-                           sum += row[j] * vec[j];
-                       }
-                       return sum;
-                   });
+    std::vector<double> result(matrix.size());
+
+    // Rows are split over the shared pool, 2 FLOPs per matrix element
+    ThreadPool::instance().parallelFor(matrix.size(), 2.0 * static_cast<double>(vec.size()),
+        [&](const std::size_t begin, const std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                const std::vector<double>& row = matrix[i];
+                double sum = 0.0;
+                for (std::size_t j = 0; j < vec.size(); ++j) {
+                    sum += row[j] * vec[j];
+                }
+                result[i] = sum;
+            }
+        });
 
     return result;
-};
+}
 
-std::vector<double> UtilityFunctions::SigmoidVector(const std::vector<double>& vec) {
-    std::vector<double> result(vec.size());
-    std::transform(std::execution::par,
-        vec.begin(), vec.end(), result.begin(),
-        [](const double value) {
-            return 1.0 / (1.0 + exp(-value));
+void UtilityFunctions::multiplyMatrixVector(const double* matrix, const std::size_t rows, const std::size_t cols,
+                                            const double* vec, double* result) {
+    ThreadPool::instance().parallelFor(rows, 2.0 * static_cast<double>(cols),
+        [&](const std::size_t begin, const std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                const double* row = matrix + i * cols;
+                double sum = 0.0;
+                for (std::size_t j = 0; j < cols; ++j) {
+                    sum += row[j] * vec[j];
+                }
+                result[i] = sum;
+            }
         });
-    return result;
+}
+
+std::vector<double> UtilityFunctions::SigmoidVector(const std::vector<double>& vec) {
+    return Expr::evaluate(Expr::sigmoid(vec));
 }
 
 std::vector<double> UtilityFunctions::ReluVector(const std::vector<double> &vec) {
-    std::vector<double> result(vec.size());
-    std::transform(std::execution::par,
-        vec.begin(), vec.end(), result.begin(),
-        [](const double value) {
-            return value > 0 ? value : 0;
-        });
-    return result;
+    return Expr::evaluate(Expr::relu(vec));
 }
 
 double UtilityFunctions::ReluDerivative(double value) {
@@ -75,13 +89,16 @@ std::vector<double> UtilityFunctions::VectorAddition(const std::vector<double>&
             "Vector dimensions mismatch: vec1 size = " + std::to_string(vec1.size()) +
             ", vec2 size = " + std::to_string(vec2.size()));
     }
-    std::vector<double> result(vec1.size());
-    std::transform(std::execution::par,
-        vec1.begin(), vec1.end(), vec2.begin(),  result.begin(),
-        [](const double val1, const double val2) {
-            return val1 + val2;
-        });
-    return result;
+    return Expr::evaluate(Expr::ref(vec1) + vec2);
+}
+
+void UtilityFunctions::AddInPlace(std::vector<double>& vec1, const std::vector<double>& vec2) {
+    if (vec1.size() != vec2.size()) {
+        throw std::invalid_argument(
+            "Vector dimensions mismatch: vec1 size = " + std::to_string(vec1.size()) +
+            ", vec2 size = " + std::to_string(vec2.size()));
+    }
+    Expr::assign(vec1, Expr::ref(vec1) + vec2);
 }
 
 // Parallelized Mean Squared Error
@@ -91,13 +108,7 @@ std::vector<double> UtilityFunctions::MSE(const std::vector<double> &actual, con
             "Vector dimensions mismatch: arg1 size = " + std::to_string(actual.size()) +
             ", arg2 size = " + std::to_string(expected.size()));
     }
-    std::vector<double> result(actual.size());
-    std::transform(std::execution::par,
-        actual.begin(), actual.end(), expected.begin(), result.begin(),
-        [](const double val1, const double val2) {
-                return std::pow(val1 - val2, 2);
-        });
-    return result;
+    return Expr::evaluate(Expr::square(Expr::ref(actual) - expected));
 }
 
 std::vector<double> UtilityFunctions::MSE_derivative(const std::vector<double> &actual,
@@ -107,17 +118,12 @@ std::vector<double> UtilityFunctions::MSE_derivative(const std::vector<double> &
             "Vector dimensions mismatch: arg1 size = " + std::to_string(actual.size()) +
             ", arg2 size = " + std::to_string(expected.size()));
     }
-    std::vector<double> result(actual.size());
-    std::transform(std::execution::par,
-    actual.begin(), actual.end(), expected.begin(), result.begin(),
-    [&](const double val1, const double val2) {
-        return (2 * (val1 - val2)) / static_cast<double>(actual.size()); // Normalize by vector size
-    });
-    return result;
+    // Normalize by vector size
+    return Expr::evaluate(2.0 * (Expr::ref(actual) - expected) / static_cast<double>(actual.size()));
 }
 
 double UtilityFunctions::SigmoidDerivative(const double value) {
-    const double sigmoid = 1.0 / (1.0 + exp(-value));
+    const double sigmoid = 1.0 / (1.0 + ActivationMath::exp(-value));
     return sigmoid * (1 - sigmoid);
 }
 
@@ -131,6 +137,46 @@ std::vector<double> oneHotEncode(int label, int numClasses = 10) {
     return oneHot;
 }
 
+void UtilityFunctions::writeFileAtomic(const std::string& path, const void* data, const std::size_t size) {
+    const std::string temporary = path + ".tmp";
+    std::FILE* file = std::fopen(temporary.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Unable to open file: " + temporary);
+    }
+    // Data must be on disk before the rename makes it visible, or a crash could publish a torn file
+    bool written = std::fwrite(data, 1, size, file) == size && std::fflush(file) == 0;
+#ifdef __linux__
+    written = written && ::fsync(fileno(file)) == 0;
+#endif
+    if (std::fclose(file) != 0 || !written) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Unable to write file: " + temporary);
+    }
+    const std::filesystem::path target(path);
+    std::filesystem::rename(temporary, target);
+#ifdef __linux__
+    // Persist the rename itself
+    const std::string directory = target.has_parent_path() ? target.parent_path().string() : ".";
+    if (const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY); fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+#endif
+}
+
+std::vector<char> UtilityFunctions::readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open file: " + path);
+    }
+    std::vector<char> contents(static_cast<std::size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(contents.data(), static_cast<std::streamsize>(contents.size()))) {
+        throw std::runtime_error("Unable to read file: " + path);
+    }
+    return contents;
+}
+
 std::vector<ImageData> UtilityFunctions::loadData(const std::string& filename, bool isTest) {
     std::vector<ImageData> dataset; // Vector to store all image data
     std::ifstream file(filename);
@@ -182,14 +228,15 @@ std::vector<ImageData> UtilityFunctions::loadData(const std::string& filename, b
 std::vector<double> UtilityFunctions::Softmax(const std::vector<double>& input) {
     std::vector<double> output(input.size());
     double maxInput = *std::ranges::max_element(input); // Shift by max value
-    double sum = 0.0;
 
-    for (double val : input) {
-        sum += std::exp(val - maxInput);
+    for (std::size_t i = 0; i < input.size(); ++i) {
+        output[i] = input[i] - maxInput;
     }
+    ActivationMath::exp(output.data(), output.data(), output.size());
+    const double sum = std::reduce(output.begin(), output.end(), 0.0);
 
-    for (std::size_t i = 0; i < input.size(); ++i) {
-        output[i] = std::exp(input[i] - maxInput) / sum;
+    for (double& val : output) {
+        val /= sum;
     }
 
     return output;
@@ -202,4 +249,59 @@ double UtilityFunctions::CrossEntropy(const std::vector<double>& predicted, cons
         loss -= actual[i] * std::log(clamped_pred);
     }
     return loss;
-}
\ No newline at end of file
+}
+
+double UtilityFunctions::SoftmaxCrossEntropy(const std::vector<double>& logits, const std::vector<double>& expected,
+                                             std::vector<double>& probabilities, std::vector<double>& gradient) {
+    if (logits.size() != expected.size() || logits.empty()) {
+        throw std::invalid_argument(
+            "Vector dimensions mismatch: logits size = " + std::to_string(logits.size()) +
+            ", expected size = " + std::to_string(expected.size()));
+    }
+    probabilities.resize(logits.size());
+    gradient.resize(logits.size());
+
+    // exp(z - max) is computed once, vectorized, into the probabilities buffer
+    const double maxLogit = *std::ranges::max_element(logits);
+    for (std::size_t i = 0; i < logits.size(); ++i) {
+        probabilities[i] = logits[i] - maxLogit;
+    }
+    ActivationMath::exp(probabilities.data(), probabilities.data(), probabilities.size());
+    const double sum = std::reduce(probabilities.begin(), probabilities.end(), 0.0);
+    const double logSum = maxLogit + std::log(sum);
+    const double inverseSum = 1.0 / sum;
+
+    double loss = 0.0;
+    for (std::size_t i = 0; i < logits.size(); ++i) {
+        probabilities[i] *= inverseSum;
+        gradient[i] = probabilities[i] - expected[i];
+        loss -= expected[i] * (logits[i] - logSum);
+    }
+    return loss;
+}
+
+double UtilityFunctions::SoftmaxCrossEntropy(const std::vector<double>& logits, const std::size_t label,
+                                             std::vector<double>& probabilities, std::vector<double>& gradient) {
+    if (label >= logits.size()) {
+        throw std::invalid_argument(
+            "Label out of range: label = " + std::to_string(label) +
+            ", logits size = " + std::to_string(logits.size()));
+    }
+    probabilities.resize(logits.size());
+    gradient.resize(logits.size());
+
+    const double maxLogit = *std::ranges::max_element(logits);
+    for (std::size_t i = 0; i < logits.size(); ++i) {
+        probabilities[i] = logits[i] - maxLogit;
+    }
+    ActivationMath::exp(probabilities.data(), probabilities.data(), probabilities.size());
+    const double sum = std::reduce(probabilities.begin(), probabilities.end(), 0.0);
+    const double inverseSum = 1.0 / sum;
+
+    for (std::size_t i = 0; i < logits.size(); ++i) {
+        probabilities[i] *= inverseSum;
+        gradient[i] = probabilities[i];
+    }
+    gradient[label] -= 1.0;
+    return maxLogit + std::log(sum) - logits[label];
+}
@@ -15,19 +15,35 @@ struct ImageData {
 class UtilityFunctions {
 public:
     static std::vector<double> multiplyMatrixVector(const std::vector<std::vector<double>>& matrix, const std::vector<double>& vec);
+    // Flat row-major rows x cols matrix, e.g. weights living in a mapped file
+    static void multiplyMatrixVector(const double* matrix, std::size_t rows, std::size_t cols, const double* vec,
+                                     double* result);
     static std::vector<double> SigmoidVector(const std::vector<double>& vec);
     static std::vector<double> ReluVector(const std::vector<double>& vec);
     static double ReluDerivative(double value);
     static std::vector<double> VectorAddition(const std::vector<double>& vec1, const std::vector<double>&  vec2);
+    static void AddInPlace(std::vector<double>& vec1, const std::vector<double>& vec2);
     static std::vector<double> MSE(const std::vector<double>& actual, const std::vector<double>&  expected);
     //  double sum_vector = std::reduce(std::execution::seq, vec.begin(), vec.end(), 0.0);
     static std::vector<double> MSE_derivative(const std::vector<double>& actual, const std::vector<double>&  expected);
     static double SigmoidDerivative(double value);
     static std::vector<ImageData> loadData(const std::string& filename, bool isTest);
+    // Writes a sibling temporary file, fsyncs it and renames it over path, so readers and crashes
+    // only ever see the old or the new contents
+    static void writeFileAtomic(const std::string& path, const void* data, std::size_t size);
+    static std::vector<char> readFile(const std::string& path);
 
     static std::vector<double> Softmax(const std::vector<double> &input);
 
     static double CrossEntropy(const std::vector<double> &predicted, const std::vector<double> &actual);
+
+    // Fused log-softmax + cross-entropy: writes softmax(logits) and the loss gradient (probabilities - expected)
+    // into caller-owned buffers and returns the loss
+    static double SoftmaxCrossEntropy(const std::vector<double> &logits, const std::vector<double> &expected,
+                                      std::vector<double> &probabilities, std::vector<double> &gradient);
+    // Same with a class index instead of a one-hot target
+    static double SoftmaxCrossEntropy(const std::vector<double> &logits, std::size_t label,
+                                      std::vector<double> &probabilities, std::vector<double> &gradient);
 };
 
 
@@ -0,0 +1,317 @@
+#ifndef VECTOREXPRESSION_H
+#define VECTOREXPRESSION_H
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ActivationMath.h"
+#include "ThreadPool.h"
+
+// Lazy vector algebra. Operators and functions on expression nodes build a tree instead of a std::vector;
+// assign() evaluates the whole tree in one parallel sweep over the destination, a tile at a time, so
+// intermediate values only ever live in a stack buffer in L1. Transcendentals run the vectorized
+// ActivationMath kernels over whole tiles.
+//
+//     Expr::assign(y, Expr::sigmoid(Expr::matrix(W) * x + b));
+//     const double squaredError = Expr::sum(Expr::square(Expr::ref(actual) - expected));
+//
+// Nodes refer to the std::vectors they read, so an expression must be evaluated while its operands are
+// alive. The destination may appear element-wise in its own expression, but not as the vector of a matrix
+// product. An operator only applies when one of its operands already is a node, start a chain with ref().
+namespace Expr {
+
+// Elements a node produces per evaluate() call
+inline constexpr std::size_t Tile = 256;
+
+// Base of every node, so the operators never pick up plain std::vectors
+struct Node {};
+
+template <typename E>
+concept Expression = std::derived_from<E, Node> &&
+    requires(const E& e, const std::size_t begin, const std::size_t count, double* out) {
+        { e.size() } -> std::convertible_to<std::size_t>;
+        { e.flops() } -> std::convertible_to<double>; // per element, sizes the parallel chunks
+        e.evaluate(begin, count, out);                // out[0, count) = elements [begin, begin + count), count <= Tile
+    };
+
+template <typename T>
+concept VectorOperand = Expression<std::remove_cvref_t<T>> || std::same_as<std::remove_cvref_t<T>, std::vector<double>>;
+
+template <typename T>
+concept Operand = VectorOperand<T> || std::is_arithmetic_v<std::remove_cvref_t<T>>;
+
+// A std::vector read in place
+class Ref : public Node {
+public:
+    explicit Ref(const std::vector<double>& values) : values(&values) {}
+    [[nodiscard]] std::size_t size() const { return values->size(); }
+    [[nodiscard]] double flops() const { return 0.0; }
+    void evaluate(const std::size_t begin, const std::size_t count, double* out) const {
+        const double* source = values->data() + begin;
+        if (out != source) { // the destination reading itself
+            std::copy_n(source, count, out);
+        }
+    }
+
+private:
+    const std::vector<double>* values;
+};
+
+// A scalar broadcast to the length of the other operand
+class Constant : public Node {
+public:
+    Constant(const double value, const std::size_t length) : value(value), length(length) {}
+    [[nodiscard]] std::size_t size() const { return length; }
+    [[nodiscard]] double flops() const { return 0.0; }
+    void evaluate(std::size_t, const std::size_t count, double* out) const { std::fill_n(out, count, value); }
+
+private:
+    double value;
+    std::size_t length;
+};
+
+template <typename Op, Expression L, Expression R>
+class Binary : public Node {
+public:
+    Binary(L left, R right) : left(std::move(left)), right(std::move(right)) {
+        if (this->left.size() != this->right.size()) {
+            throw std::invalid_argument(
+                "Vector dimensions mismatch: vec1 size = " + std::to_string(this->left.size()) +
+                ", vec2 size = " + std::to_string(this->right.size()));
+        }
+    }
+    [[nodiscard]] std::size_t size() const { return left.size(); }
+    [[nodiscard]] double flops() const { return left.flops() + right.flops() + Op::Flops; }
+    void evaluate(const std::size_t begin, const std::size_t count, double* out) const {
+        double operand[Tile];
+        left.evaluate(begin, count, out);
+        right.evaluate(begin, count, operand);
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = Op::apply(out[i], operand[i]);
+        }
+    }
+
+private:
+    L left;
+    R right;
+};
+
+// Op::apply(values, count) transforms a tile in place
+template <typename Op, Expression E>
+class Unary : public Node {
+public:
+    explicit Unary(E operand) : operand(std::move(operand)) {}
+    [[nodiscard]] std::size_t size() const { return operand.size(); }
+    [[nodiscard]] double flops() const { return operand.flops() + Op::Flops; }
+    void evaluate(const std::size_t begin, const std::size_t count, double* out) const {
+        operand.evaluate(begin, count, out);
+        Op::apply(out, count);
+    }
+
+private:
+    E operand;
+};
+
+// Row i of W * x is produced when element i is, so a bias and an activation applied to the product
+// never see a materialized W * x
+class MatrixVector : public Node {
+public:
+    MatrixVector(const std::vector<std::vector<double>>& matrix, const std::vector<double>& vec)
+        : matrix(&matrix), vec(&vec) {
+        if (matrix.empty() || vec.empty() || matrix[0].size() != vec.size()) {
+            std::ostringstream oss;
+            oss << "Matrix and vector dimensions are incompatible. "
+                << "Matrix dimensions: " << matrix.size() << "x" << (matrix.empty() ? 0 : matrix[0].size()) << ", "
+                << "Vector size: " << vec.size() << "x1";
+            throw std::invalid_argument(oss.str());
+        }
+    }
+    [[nodiscard]] std::size_t size() const { return matrix->size(); }
+    [[nodiscard]] double flops() const { return 2.0 * static_cast<double>(vec->size()); }
+    void evaluate(const std::size_t begin, const std::size_t count, double* out) const {
+        const std::size_t cols = vec->size();
+        const double* x = vec->data();
+        for (std::size_t i = 0; i < count; ++i) {
+            const double* row = (*matrix)[begin + i].data();
+            double sum = 0.0;
+            for (std::size_t j = 0; j < cols; ++j) {
+                sum += row[j] * x[j];
+            }
+            out[i] = sum;
+        }
+    }
+
+private:
+    const std::vector<std::vector<double>>* matrix;
+    const std::vector<double>* vec;
+};
+
+struct MatrixRef {
+    const std::vector<std::vector<double>>& rows;
+};
+
+inline MatrixVector operator*(const MatrixRef& matrix, const std::vector<double>& vec) {
+    return {matrix.rows, vec};
+}
+
+// Element-wise operations
+struct Add { static constexpr double Flops = 1.0; static double apply(const double a, const double b) { return a + b; } };
+struct Subtract { static constexpr double Flops = 1.0; static double apply(const double a, const double b) { return a - b; } };
+struct Multiply { static constexpr double Flops = 1.0; static double apply(const double a, const double b) { return a * b; } };
+struct Divide { static constexpr double Flops = 4.0; static double apply(const double a, const double b) { return a / b; } };
+
+struct Negate {
+    static constexpr double Flops = 1.0;
+    static void apply(double* values, const std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            values[i] = -values[i];
+        }
+    }
+};
+
+struct Square {
+    static constexpr double Flops = 1.0;
+    static void apply(double* values, const std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            values[i] *= values[i];
+        }
+    }
+};
+
+struct Relu {
+    static constexpr double Flops = 1.0;
+    static void apply(double* values, const std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            values[i] = values[i] > 0.0 ? values[i] : 0.0;
+        }
+    }
+};
+
+struct Sigmoid {
+    static constexpr double Flops = 20.0;
+    static void apply(double* values, const std::size_t count) { ActivationMath::sigmoid(values, values, count); }
+};
+
+struct Tanh {
+    static constexpr double Flops = 20.0;
+    static void apply(double* values, const std::size_t count) { ActivationMath::tanh(values, values, count); }
+};
+
+struct Exp {
+    static constexpr double Flops = 20.0;
+    static void apply(double* values, const std::size_t count) { ActivationMath::exp(values, values, count); }
+};
+
+namespace detail {
+    inline constexpr std::size_t AnySize = std::numeric_limits<std::size_t>::max();
+
+    template <Operand T>
+    std::size_t sizeOf(const T& operand) {
+        if constexpr (std::is_arithmetic_v<std::remove_cvref_t<T>>) {
+            return AnySize;
+        } else {
+            return operand.size();
+        }
+    }
+
+    // Nodes are held by value, vectors by reference, scalars are broadcast to length
+    template <Operand T>
+    auto lift(T&& operand, const std::size_t length) {
+        using Type = std::remove_cvref_t<T>;
+        if constexpr (Expression<Type>) {
+            return Type(std::forward<T>(operand));
+        } else if constexpr (std::same_as<Type, std::vector<double>>) {
+            return Ref(operand);
+        } else {
+            return Constant(static_cast<double>(operand), length);
+        }
+    }
+
+    template <typename Op, Operand L, Operand R>
+    auto combine(L&& left, R&& right) {
+        const std::size_t leftSize = sizeOf(left);
+        const std::size_t length = leftSize != AnySize ? leftSize : sizeOf(right);
+        auto l = lift(std::forward<L>(left), length);
+        auto r = lift(std::forward<R>(right), length);
+        return Binary<Op, decltype(l), decltype(r)>(std::move(l), std::move(r));
+    }
+
+    template <typename Op, VectorOperand E>
+    auto transform(E&& operand) {
+        auto e = lift(std::forward<E>(operand), sizeOf(operand));
+        return Unary<Op, decltype(e)>(std::move(e));
+    }
+}
+
+template <typename L, typename R>
+concept NodeOperands = Operand<L> && Operand<R> &&
+                       (Expression<std::remove_cvref_t<L>> || Expression<std::remove_cvref_t<R>>);
+
+inline Ref ref(const std::vector<double>& values) { return Ref(values); }
+inline MatrixRef matrix(const std::vector<std::vector<double>>& rows) { return MatrixRef{rows}; }
+
+template <typename L, typename R> requires NodeOperands<L, R>
+auto operator+(L&& left, R&& right) { return detail::combine<Add>(std::forward<L>(left), std::forward<R>(right)); }
+template <typename L, typename R> requires NodeOperands<L, R>
+auto operator-(L&& left, R&& right) { return detail::combine<Subtract>(std::forward<L>(left), std::forward<R>(right)); }
+template <typename L, typename R> requires NodeOperands<L, R>
+auto operator*(L&& left, R&& right) { return detail::combine<Multiply>(std::forward<L>(left), std::forward<R>(right)); }
+template <typename L, typename R> requires NodeOperands<L, R>
+auto operator/(L&& left, R&& right) { return detail::combine<Divide>(std::forward<L>(left), std::forward<R>(right)); }
+
+template <typename E> requires Expression<std::remove_cvref_t<E>>
+auto operator-(E&& operand) { return detail::transform<Negate>(std::forward<E>(operand)); }
+
+// Functions also accept a plain std::vector
+template <VectorOperand E> auto square(E&& operand) { return detail::transform<Square>(std::forward<E>(operand)); }
+template <VectorOperand E> auto relu(E&& operand) { return detail::transform<Relu>(std::forward<E>(operand)); }
+template <VectorOperand E> auto sigmoid(E&& operand) { return detail::transform<Sigmoid>(std::forward<E>(operand)); }
+template <VectorOperand E> auto tanh(E&& operand) { return detail::transform<Tanh>(std::forward<E>(operand)); }
+template <VectorOperand E> auto exp(E&& operand) { return detail::transform<Exp>(std::forward<E>(operand)); }
+
+// destination = expression, split over the shared pool
+template <Expression E>
+void assign(std::vector<double>& destination, const E& expression) {
+    const std::size_t size = expression.size();
+    destination.resize(size);
+    ThreadPool::instance().parallelFor(size, expression.flops() + 1.0,
+        [&](const std::size_t begin, const std::size_t end) {
+            for (std::size_t tile = begin; tile < end; tile += Tile) {
+                expression.evaluate(tile, std::min(Tile, end - tile), destination.data() + tile);
+            }
+        });
+}
+
+template <Expression E>
+std::vector<double> evaluate(const E& expression) {
+    std::vector<double> result;
+    assign(result, expression);
+    return result;
+}
+
+// Sum of all elements, tile by tile in order, so the result does not depend on the thread count
+template <Expression E>
+double sum(const E& expression) {
+    double values[Tile];
+    double total = 0.0;
+    for (std::size_t tile = 0; tile < expression.size(); tile += Tile) {
+        const std::size_t count = std::min(Tile, expression.size() - tile);
+        expression.evaluate(tile, count, values);
+        for (std::size_t i = 0; i < count; ++i) {
+            total += values[i];
+        }
+    }
+    return total;
+}
+
+} // namespace Expr
+
+#endif //VECTOREXPRESSION_H
@@ -1,8 +1,17 @@
 #include <algorithm>
+#include <cstdlib>
 #include <iostream>
+#include <Checkpointer.h>
+#include <DataParallel.h>
+#include <Dataset.h>
 #include <NeuralNetwork.h>
+#include <SampleStream.h>
+#include <TcpAllreduce.h>
+#include <ThreadPool.h>
 #include <UtilityFunctions.h>
+#include <filesystem>
 #include <fstream>
+#include <future>
 
 void saveAsPGM(const std::vector<double>& pixels, const std::string& filename, int width, int height) {
     if (pixels.size() != width * height) {
@@ -46,47 +55,101 @@ void writeResultsToCSV(const std::string& filename, const std::vector<int>& pred
     std::cout << "Results written to " << filename << std::endl;
 }
 
-int main() {
-    const std::string trainDataPath = "train.csv"; // Replace with your file path
-    std::vector<ImageData> trainData = UtilityFunctions::loadData(trainDataPath, false);
+// Online mode: NeuralNetwork --online <source> [snapshot]. source is "-" for stdin, a file or FIFO path, or
+// unix:<socket path>. Training resumes from the snapshot if it exists and republishes it as it learns.
+int runOnline(const std::string& source, const std::string& snapshotPath) {
+    SampleStream stream(source);
+    const bool resume = std::filesystem::exists(snapshotPath);
+    auto network = resume ? NeuralNetwork::load(snapshotPath) : NeuralNetwork(stream.featureCount());
+    if (!resume) {
+        network.add_layer(128); // hidden layer
+        network.add_layer(64);
+        network.add_layer(32);
+        network.add_layer(stream.classCount()); // Output layer
+    }
+    network.setLearningRate(0.1);
+    OnlineTrainingConfig config;
+    config.snapshotPath = snapshotPath;
+    ThreadPool::instance().pinCallingThread();
+    network.trainOnline(stream, config);
+    return 0;
+}
+
+int main(const int argc, char* argv[]) {
+    if (argc >= 3 && std::string(argv[1]) == "--online") {
+        return runOnline(argv[2], argc >= 4 ? argv[3] : "model.bin");
+    }
+
+    // The test set is parsed on a thread of its own while the training set loads and the network trains. File
+    // I/O blocks, so it stays off the pool workers the training kernels need.
     const std::string testDataPath = "test.csv"; // Replace with your file path
-    std::vector<ImageData> testData = UtilityFunctions::loadData(testDataPath, true);
+    std::future<Dataset> testLoad =
+        std::async(std::launch::async, [&] { return Dataset::loadCsv(testDataPath, false); });
+    // This thread trains, it takes the pool's last CPU once the loader thread is running elsewhere
+    ThreadPool::instance().pinCallingThread();
+    const std::string trainDataPath = "train.csv"; // Replace with your file path
+    Dataset trainData = Dataset::loadCsv(trainDataPath, true);
 
-    // Separate train data into two vectors: one for pixels, one for labels
-    std::vector<std::vector<double>> trainPixels;
-    std::vector<std::vector<double>> trainLabels;
+    // Hold out the last 10% of the training data for per-epoch validation
+    const Dataset validationData = trainData.takeTail(trainData.size() / 10);
 
-    for (const auto&[label, pixels] : trainData) {
-        trainPixels.push_back(pixels); // Extract pixels
-        trainLabels.push_back(label); // Extract labels
+    // A run interrupted by a crash resumes from its last checkpoint, a finished run removes it
+    const std::string checkpointPath = "checkpoint.bin";
+    const int epochs = 10;
+    const bool resume = std::filesystem::exists(checkpointPath);
+    auto network = resume ? NeuralNetwork::restoreCheckpoint(checkpointPath)
+                          : NeuralNetwork(trainData.featureCount()); // Initialize network and input layer
+    // NN_PEERS lists the nodes of a multi-node run (with NN_RANK this node's place in it). Every node must start
+    // from the same weights and shuffle the same way, so they share a seed.
+    const TcpAllreduceConfig cluster = TcpAllreduceConfig::fromEnvironment();
+    if (!resume) {
+        if (!cluster.peers.empty()) {
+            network.setSeed(1);
+        }
+        network.setLearningRate(0.1);
+        network.add_layer(128); // hidden layer
+        network.add_layer(64);
+        network.add_layer(32);
+        network.add_layer(trainData.classCount()); // Output layer
     }
-    for (auto& pixels : trainPixels) {
-        std::ranges::transform(pixels, pixels.begin(),
-                               [](const double val) { return val / 255.0; });
+    // NN_ACTIVATION_BYTES caps the activations held per sample, recomputing the rest in the backward pass
+    if (const char* activationBudget = std::getenv("NN_ACTIVATION_BYTES")) {
+        network.setActivationMemoryBudget(std::stoull(activationBudget));
     }
-    auto network = NeuralNetwork(trainPixels[0].size()); // Initialize network and input layer
-    network.setLearningRate(0.1);
-    network.add_layer(128); // hidden layer
-    network.add_layer(64);
-    network.add_layer(32);
-    network.add_layer(trainLabels[0].size()); // Output layer
-    network.train(trainPixels, trainLabels, 10);
-
-    // Separate train data into two vectors: one for pixels, one for labels
-    std::vector<std::vector<double>> testPixels;
-    std::vector<std::vector<double>> testLabels;
-    int num = 0;
-    for (const auto&[label, pixels] : testData) {
-        testPixels.push_back(pixels); // Extract pixels
-        testLabels.push_back(label); // Extract labels
-        if (num++ > 10) {
-            break;
-        }
+    // NN_AUTOTUNE=1 benchmarks the layer kernels once per machine and shape, cached in NN_TUNING_FILE
+    if (const char* autotune = std::getenv("NN_AUTOTUNE"); autotune != nullptr && std::string(autotune) == "1") {
+        network.setKernelAutotuning(true);
+    }
+    const MemoryPlan plan = network.planMemory(true);
+    std::cout << "Per-sample training buffers: " << plan.peakBytes() << " bytes planned, " << plan.totalBytes()
+              << " without reuse" << std::endl;
+    // NN_PROCESSES > 1 trains that many data-parallel replicas, each on its own slice of the CPUs
+    const char* processesValue = std::getenv("NN_PROCESSES");
+    const std::size_t processes = processesValue != nullptr ? std::stoul(processesValue) : 1;
+    if (!cluster.peers.empty()) {
+        TcpAllreduce allreduce(cluster, network.parameterCount() + 1);
+        network.trainReplica(trainData, epochs - static_cast<int>(network.epochsCompleted()), allreduce,
+                             &validationData);
+    } else if (processes > 1) {
+        // The children do not inherit the loader thread and never touch its result
+        DataParallel::train(network, trainData, epochs - static_cast<int>(network.epochsCompleted()), processes,
+                            &validationData);
+    } else {
+        Checkpointer checkpointer(checkpointPath);
+        network.setCheckpointer(&checkpointer, 1000);
+        network.train(trainData, epochs - static_cast<int>(network.epochsCompleted()), &validationData);
+        network.setCheckpointer(nullptr, 0);
+        checkpointer.flush();
     }
+    std::filesystem::remove(checkpointPath);
+
+    const Dataset testData = testLoad.get();
     //
     std::vector<long long int> predictions;
-    for (const auto & testPixel : testPixels) {
-        auto result = network.predict(testPixel);
+    std::vector<double> testPixels;
+    for (std::size_t i = 0; i < std::min<std::size_t>(testData.size(), 12); ++i) {
+        testData.features(i, testPixels);
+        auto result = network.predict(testPixels);
         // Find the index of the maximum element
         long long int maxIndex = std::distance(result.begin(), std::ranges::max_element(result));
         predictions.push_back(maxIndex);
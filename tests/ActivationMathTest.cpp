@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "ActivationMath.h"
+
+// Sweeps every accuracy tier over the input range the network uses and checks the error bounds documented in
+// ActivationMath.h against libm: relative error for exp and sigmoid, absolute error for tanh.
+
+static int failures = 0;
+
+struct Bounds {
+    MathAccuracy accuracy;
+    const char* name;
+    double bound;
+};
+
+struct Errors {
+    double exp = 0.0;
+    double sigmoid = 0.0;
+    double tanh = 0.0;
+};
+
+// count evenly spaced points of [-limit, limit]
+static std::vector<double> grid(const double limit, const std::size_t count) {
+    std::vector<double> points(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        points[i] = -limit + 2.0 * limit * static_cast<double>(i) / static_cast<double>(count - 1);
+    }
+    return points;
+}
+
+static Errors measure(const std::vector<double>& x) {
+    const std::size_t count = x.size();
+    std::vector<double> exp(count);
+    std::vector<double> sigmoid(count);
+    std::vector<double> tanh(count);
+    ActivationMath::exp(x.data(), exp.data(), count);
+    ActivationMath::sigmoid(x.data(), sigmoid.data(), count);
+    ActivationMath::tanh(x.data(), tanh.data(), count);
+
+    Errors errors;
+    for (std::size_t i = 0; i < count; ++i) {
+        const double expected = std::exp(x[i]);
+        errors.exp = std::max(errors.exp, std::fabs(exp[i] - expected) / expected);
+        // The scalar entry point runs the same tier
+        errors.exp = std::max(errors.exp, std::fabs(ActivationMath::exp(x[i]) - expected) / expected);
+        const double expectedSigmoid = 1.0 / (1.0 + std::exp(-x[i]));
+        errors.sigmoid = std::max(errors.sigmoid, std::fabs(sigmoid[i] - expectedSigmoid) / expectedSigmoid);
+        // tanh(x) = 1 - 2 / (e^2x + 1) is only defined up to e^700 by the exp bound
+        if (std::fabs(x[i]) <= 350.0) {
+            errors.tanh = std::max(errors.tanh, std::fabs(tanh[i] - std::tanh(x[i])));
+        }
+    }
+    return errors;
+}
+
+int main() {
+    // Coarse over the whole range, fine where activations usually fall and around 0
+    std::vector<double> x = grid(700.0, 1000001);
+    for (const double limit : {20.0, 1e-3}) {
+        const std::vector<double> fine = grid(limit, 1000001);
+        x.insert(x.end(), fine.begin(), fine.end());
+    }
+
+    for (const Bounds& tier : {Bounds{MathAccuracy::Exact, "exact", 0.0},
+                               Bounds{MathAccuracy::Fast, "fast", 1e-8},
+                               Bounds{MathAccuracy::Faster, "faster", 6e-5}}) {
+        ActivationMath::setAccuracy(tier.accuracy);
+        const Errors errors = measure(x);
+        std::cout << tier.name << ": exp " << errors.exp << ", sigmoid " << errors.sigmoid << ", tanh "
+                  << errors.tanh << " (bound " << tier.bound << ")" << std::endl;
+        if (errors.exp > tier.bound || errors.sigmoid > tier.bound || errors.tanh > tier.bound) {
+            std::cerr << "FAILED: " << tier.name << " exceeds its documented error bound" << std::endl;
+            ++failures;
+        }
+    }
+
+    if (failures == 0) {
+        std::cout << "ActivationMathTest passed" << std::endl;
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
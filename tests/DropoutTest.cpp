@@ -0,0 +1,53 @@
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "NeuralNetwork.h"
+
+// backPropagate after predict() on a network with dropout must take the deterministic derivative: predict() draws
+// no dropout mask, so there is none to apply.
+
+static int failures = 0;
+
+static void check(const bool condition, const char* what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+int main() {
+    const std::vector<double> input = {0.5, -0.25, 1.0, 0.75};
+    const std::vector<double> target = {0.0, 1.0, 0.0};
+
+    NeuralNetwork network(input.size());
+    network.setSeed(5);
+    network.add_layer(200);
+    network.add_dropout(0.5);
+    network.add_layer(3);
+
+    // The same network without dropout takes exactly the same step
+    NeuralNetwork plain(input.size());
+    plain.setSeed(5);
+    plain.add_layer(200);
+    plain.add_layer(3);
+
+    for (int step = 0; step < 3; ++step) {
+        const std::vector<double> output = network.predict(input);
+        network.backPropagate(output, target, 0.1);
+        const std::vector<double> plainOutput = plain.predict(input);
+        plain.backPropagate(plainOutput, target, 0.1);
+        check(output == plainOutput, "predict ignores dropout");
+    }
+    check(network.predict(input) == plain.predict(input), "backPropagate after predict ignores dropout");
+
+    // A training step in between leaves a mask behind, the next predict must not reuse it
+    network.trainSample(input, std::size_t{1});
+    const std::vector<double> output = network.predict(input);
+    network.backPropagate(output, target, 0.1);
+
+    if (failures == 0) {
+        std::cout << "DropoutTest passed" << std::endl;
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
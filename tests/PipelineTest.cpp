@@ -0,0 +1,124 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "Dataset.h"
+#include "NeuralNetwork.h"
+#include "Pipeline.h"
+
+// Pipeline::predict with a wrong-sized input in the middle of a batch must throw without leaving samples in
+// flight, and the pipeline must keep serving requests afterwards. Pipeline::train with a micro-batch of one must
+// be the plain per-sample SGD of NeuralNetwork::train, dropout and noise streams included.
+
+static int failures = 0;
+
+static void check(const bool condition, const char* what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+static void predictRecovers() {
+    constexpr std::size_t features = 12;
+    NeuralNetwork network(features);
+    network.setSeed(3);
+    network.add_layer(16);
+    network.add_layer(8);
+    network.add_layer(8);
+    network.add_layer(4);
+
+    std::mt19937 generator(11);
+    std::uniform_real_distribution<double> values(-1.0, 1.0);
+    std::vector<std::vector<double>> inputs(64, std::vector<double>(features));
+    for (auto& input : inputs) {
+        for (double& value : input) {
+            value = values(generator);
+        }
+    }
+    std::vector<std::vector<double>> expected;
+    for (const auto& input : inputs) {
+        expected.push_back(network.infer(input));
+    }
+
+    PipelineConfig config;
+    config.stages = 3;
+    config.queueDepth = 1;
+    Pipeline pipeline(network, config);
+
+    for (int round = 0; round < 3; ++round) {
+        std::vector<std::vector<double>> bad = inputs;
+        bad[bad.size() / 2].resize(features + 1);
+        bool threw = false;
+        try {
+            pipeline.predict(bad);
+        } catch (const std::invalid_argument&) {
+            threw = true;
+        }
+        check(threw, "predict rejects a wrong-sized input");
+        check(pipeline.predict(inputs) == expected, "predict after a rejected batch matches infer");
+    }
+    check(pipeline.predict({}).empty(), "empty batch");
+}
+
+static NeuralNetwork regularizedNetwork(const Dataset& data) {
+    NeuralNetwork network(data.featureCount());
+    network.setSeed(7);
+    network.setLearningRate(0.1);
+    network.add_layer(24, ActivationType::Relu);
+    network.add_dropout(0.2);
+    network.add_gaussian_noise(0.05);
+    network.add_layer(16, ActivationType::Tanh);
+    network.add_dropout(0.1);
+    network.add_layer(12);
+    network.add_layer(data.classCount());
+    return network;
+}
+
+static void trainMatchesPerSampleSgd() {
+    constexpr std::size_t features = 20;
+    constexpr std::size_t classes = 5;
+    Dataset data(features, classes);
+    std::mt19937 generator(5);
+    std::uniform_int_distribution<int> pixel(0, 255);
+    std::uint8_t pixels[features];
+    // 16 samples per epoch, see NeuralNetwork::EpochSampleDivisor
+    for (std::size_t i = 0; i < 1600; ++i) {
+        for (std::uint8_t& value : pixels) {
+            value = static_cast<std::uint8_t>(pixel(generator));
+        }
+        data.addSample(pixels, static_cast<std::uint8_t>(i % classes));
+    }
+
+    NeuralNetwork plain = regularizedNetwork(data);
+    plain.train(data, 3);
+
+    NeuralNetwork pipelined = regularizedNetwork(data);
+    {
+        PipelineConfig config;
+        config.stages = 3;
+        config.microBatch = 1;
+        Pipeline pipeline(pipelined, config);
+        pipeline.train(data, 3);
+    }
+
+    std::vector<char> plainState;
+    std::vector<char> pipelinedState;
+    plain.checkpointState(plainState);
+    pipelined.checkpointState(pipelinedState);
+    check(plain.samplesTrained() == pipelined.samplesTrained(), "pipeline trains as many samples");
+    check(plainState == pipelinedState, "micro-batch of one matches NeuralNetwork::train bit for bit");
+}
+
+int main() {
+    predictRecovers();
+    trainMatchesPerSampleSgd();
+
+    if (failures == 0) {
+        std::cout << "PipelineTest passed" << std::endl;
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}